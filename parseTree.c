@@ -51,6 +51,15 @@
 			error. The error message errstr should be printed. This will
 			show the user what & where the error is.
 
+			The tree may then be made smaller with optimize(), which
+			works out the parts that do not depend on any variable
+			once, rather than on every eval().
+
+			ex :
+				int removed ;
+
+				tree = optimize( tree, &removed ) ;
+
 		3. 	To evaluate the expression you pass the pointer 'tree' to eval()
 			after setting any variables you want with setVariable().
 			The integer err be non-zero if an error occurs during evaluation.
@@ -68,29 +77,102 @@
 				-----------------------------------------------*|
 				}
 
+		4.	If the tree will be evaluated very many times, compile it
+			into a flat program with compile() and evaluate that with
+			evalCompiled() instead. The value and error codes are the
+			same as for eval(). The tree may be disposed of once it has
+			been compiled.
+			ex:
+
+				void *prog ;
+
+				prog = compile( tree, &err ) ;
+				setVariable( "t", time ) ;
+				value = evalCompiled( prog, &err ) ;
+				disposProgram( prog ) ;
+
+		5.	parse() and compile() may be called from any number of
+			threads at once. setVariable(), eval(), evalCompiled(),
+			evalBatch() and optimize() share one set of variables, so
+			each thread that uses them should make its own context
+			with newEvalCtx() and call the ...Ctx() versions instead.
+			Trees and programs are only read while they are evaluated
+			and may be shared between threads.
+			ex:
+
+				void *ctx ;
+
+				ctx = newEvalCtx() ;
+				setVariableCtx( ctx, "t", time ) ;
+				value = evalCtx( ctx, tree, &err ) ;
+				disposEvalCtx( ctx ) ;
+
+		6.	A program that parses the same expressions over and over
+			can keep them in a cache made by newExprCache(). Then
+			cacheParse() only parses an expression the first time
+			and hands back the same tree every time after. Such a
+			tree must not be changed, and disposParseTree() gives
+			it back to the cache.
+			ex:
+
+				void *cache ;
+
+				cache = newExprCache( 1 << 20 ) ;
+				tree = cacheParse( cache, &temp, &err, errstr ) ;
+				value = eval( tree, &err ) ;
+				disposParseTree( tree ) ;
+
 ------------------------------------------------------------------------*/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <string.h>
 #include <strings.h>
 #include "parseTree.h"
+
+/*------------------------------------------------------------------------
+	HAVE_POSIX is 1 where there are the POSIX calls, mmap() for
+	reading files, mprotect() for the native code, sysconf(), dlopen()
+	and the threads.
+-------------------------------------------------------------------------*/
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_POSIX 1
+#else
+#define HAVE_POSIX 0
+#endif
+
+#if HAVE_POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 /*------------------------------------------------------------------------
 	Define MAIN as 1 for a test program.
 -------------------------------------------------------------------------*/
 #define MAIN 1
 #define DEBUG 0
 
+/*------------------------------------------------------------------------
+	Define BENCH as 1 for the benchmark program instead of the test
+	program.
+-------------------------------------------------------------------------*/
+#define BENCH 0
+
 #define isspace(c) ((c) == ' ')
 #define isdigit(c) (((c) >= '0') && ((c) <= '9'))
-#define advance(n) Str += (n)
+#define advance(n) c->Str += (n)
 
 #define NoOp -9999
 #define BINOP 1
 #define UNOP 2
 #define NUM 3
 #define FUNC 4
-#define CONST 9999
+#define CONST -2
 #define VarNotFound -1
 
 #define E 2.71828182845904523536
@@ -111,26 +193,26 @@ static char *OPRATOR[] = {
 	"", "", "", "", ""};
 
 /*------------------------------------------------------------------------
-	Variables, names should not conflict with function names, i.e. a
-	variable with the name 'exponent' will be parsed as the function
-	exp() and there will be a missing parenthesis error. A variable
-	with the name ex will be found OK only if it occurs before 'e'
-	in the variable array. Note that 'pi' is after to 'pi/2', this
-	is to insure that searches for pi/2 dont get stopped at pi. This
-	is a short coming of this code and it will be fixed in a later
-	version.
+	Variables. The parser reads a whole name before looking it up, as a
+	function with findFunc() and then as a variable, so a variable
+	named exponent is not taken for exp() and one named ex does not
+	stop at e. A name may not be that of a function, and a name that is
+	neither is an unexpected symbol.
+
+	More variables are added with defineVariable(). VARIABLE[] starts
+	as the built in ones below and is moved to malloc()ed memory when
+	it has to grow. VarHash[] indexes it by name, each entry is one
+	more than the index of a variable or 0 when empty, and it is kept
+	at most half full.
 -------------------------------------------------------------------------*/
 
 typedef struct var
 {
 	char *name;
-	long double val;
+	long double val; /* the value a new EVALCTX starts with */
 } VarType;
 
-static int MAX_VAR = 10;
-static int num_var = 5;
-
-static VarType VARIABLE[] = {
+static VarType Builtin[] = {
 	"t",
 	0.0,
 	"T",
@@ -139,108 +221,407 @@ static VarType VARIABLE[] = {
 	E,
 	"pi",
 	PI,
-	"  ",
-	0.0,
-	"  ",
-	0.0,
-	"  ",
-	0.0,
-	"  ",
-	0.0,
-	"  ",
-	0.0,
 };
 
+static VarType *VARIABLE = Builtin;
+static int num_var = 4;
+static int max_var = 4; /* room in VARIABLE[] */
+
+static int HashStart[16];
+static int *VarHash = HashStart;
+static int hashSize = 0; /* 0 until VarHash[] is first filled */
+
 /*------------------------------------------------------------------------
+	An EVALCTX holds everything evaluation changes, the values of the
+	variables and EvalErr. Threads that evaluate at the same time each
+	need their own, from newEvalCtx(). The functions that take no
+	context use DefaultCtx.
+
 	EvalErr is a flag that was available to the calling function. It is
 	non zero if an error occured during the expression evaluation.  New
 	versions ( >= 1.01 ) pass this value rather than have a global
 	variable.
 -----------------------------------------------------------------------*/
-static int EvalErr = 0;
+typedef struct evalContext
+{
+	long double *val; /* indexed by variable id */
+	int nval;		  /* variables val[] has room for */
+	int EvalErr;
+} EVALCTX;
+
+static long double DefaultVal[] = {0.0, 0.0, E, PI};
+static EVALCTX DefaultCtx = {DefaultVal, 4, 0};
+
+/*---------------------------------------------------
+	FITCTX(c) is 0 when c has room for every variable
+	defined so far, growing it if it has to. It is
+	not 0 only when there is no memory for that.
+---------------------------------------------------*/
+#define FITCTX(c) ((c)->nval < num_var && fitCtx(c))
 
+/*---------------------------------------------------
+	An operator node uses only the children and a
+	number only the oprand, so they share a union.
+	The oprand is kept as bytes, which lets the node
+	keep the 8 byte alignment of the pointers, and
+	is read and written with numValue()/setNum().
+---------------------------------------------------*/
 typedef struct nodeRecord
+{
+	short type;
+	int opratorid;
+	union
+	{
+		struct
+		{
+			struct nodeRecord *left, *right;
+		} kid;
+		unsigned char oprand[sizeof(long double)];
+	} u;
+
+} node, *PARSETREE;
+
+#define LEFT(n) ((n)->u.kid.left)
+#define RIGHT(n) ((n)->u.kid.right)
+
+/*---------------------------------------------------
+	A TREE is the handle parse() returns. The nodes
+	are taken in turn from an arena of blocks, each
+	a header and then room for size nodes, so that a
+	tree is built without a malloc() per node and is
+	freed a block at a time. The first block is the
+	handle and holds the root.
+---------------------------------------------------*/
+typedef struct tree
+{
+	PARSETREE root;
+	struct tree *next; /* the next block of the arena */
+	int used;		   /* nodes taken from this block */
+	int size;		   /* nodes this block holds */
+	struct cacheEntry *cached; /* the cache entry sharing it, or NULL */
+} TREE;
+
+#define TREEHDR ((sizeof(TREE) + 15) & ~(size_t)15)
+#define TREENODES(t) ((PARSETREE)((char *)(t) + TREEHDR))
+#define TREEBLOCK 1024 /* most nodes in one block */
+
+/*---------------------------------------------------
+	The op codes. OPCODES is expanded once for the
+	enum and once for the dispatch table in
+	evalCompiled() so the two cannot drift apart.
+---------------------------------------------------*/
+#define OPCODES \
+	X(OP_CONST) X(OP_VAR) X(OP_AND) X(OP_OR) X(OP_LE) \
+	X(OP_LT) X(OP_GE) X(OP_GT) X(OP_EQ) X(OP_NE) \
+	X(OP_ADD) X(OP_SUB) X(OP_MUL) X(OP_MOD) X(OP_DIV) \
+	X(OP_POW) X(OP_NOT) X(OP_NEG) X(OP_SIN) X(OP_COS) \
+	X(OP_TAN) X(OP_EXP) X(OP_LOG) X(OP_LN) X(OP_SQRT) \
+	X(OP_STEP) X(OP_ZERO) X(OP_SAVE) X(OP_LOAD) X(OP_ERR) X(OP_END)
+
+#define X(op) op,
+enum opcode { OPCODES NUMOPCODE };
+#undef X
+
+typedef struct instr
+{
+	int op;
+	int arg; /* constant index, variable id, slot or error code */
+} INSTR;
+
+typedef struct program
+{
+	int ncode;	/* instructions including the final OP_END */
+	int nconst; /* entries in the constant pool */
+	int depth;	/* deepest the value stack can get */
+	int nslot;	/* values saved for later use by OP_LOAD */
+	int mapped; /* in memory from readProgram(), not to be freed */
+} PROGRAM;
+
+/*---------------------------------------------------
+	A DAGNODE stands for every subtree of the same
+	shape. compile() finds them by hash consing,
+	giving each tree node the number of its DAGNODE
+	in vn[], in preorder.
+---------------------------------------------------*/
+typedef struct dagNode
 {
 	int type;
 	int opratorid;
-	struct nodeRecord *left, *right;
+	int left, right; /* DAGNODE numbers of the operands, or -1 */
 	long double oprand;
+	int refs; /* DAGNODEs with this one as an operand */
+	int slot; /* save slot or constant index once emitted, else -1 */
+} DAGNODE;
 
-} node, *PARSETREE;
+typedef struct dag
+{
+	DAGNODE *node;
+	int n;
+	int *hash; /* open addressing, -1 for an empty bucket */
+	int hsize; /* a power of 2 */
+	int *vn;   /* DAGNODE of each tree node */
+	int *size; /* nodes in the subtree of each tree node */
+	int nslot;
+	PARSETREE *spine; /* left runs being walked, see spine() */
+	int top;
+} DAG;
+
+/*---------------------------------------------------
+	An INCR is a DAG kept for newIncremental(), with
+	the last value of every INODE.
+---------------------------------------------------*/
+typedef struct incrNode
+{
+	int op;			   /* as in a program */
+	int arg;		   /* variable id or error code */
+	int left, right;   /* INODEs of the operands, or -1 */
+	unsigned long dep; /* DEPBIT() of the variables it depends on */
+	unsigned long gen; /* the call it was last worked out in */
+	unsigned long seen; /* the call its operands were last looked at in */
+	int err;		   /* the error its evaluation sets, or 0 */
+	long double val;
+} INODE;
 
-static char *Str;
-static char *Start_str;
+typedef struct incremental
+{
+	INODE *node; /* each after its operands */
+	int n;
+	int *var;		  /* the variables the expression reads */
+	long double *was; /* and their values at the last call */
+	int nvar;
+	int *root;	/* the INODE of each expression */
+	int nroot;
+	int *stack; /* room for the roots and two entries a node */
+	unsigned long gen;
+	int uses[8 * sizeof(unsigned long)]; /* nodes with each DEPBIT() */
+} INCR;
+
+#define PROGHDR ((sizeof(PROGRAM) + 15) & ~(size_t)15)
+#define PROGCONST(p) ((long double *)((char *)(p) + PROGHDR))
+#define PROGCODE(p) ((INSTR *)(PROGCONST(p) + ((PROGRAM *)(p))->nconst))
 
-static char err1Message[255];
-static char err2Message[255];
-static int ParseError;
+/*---------------------------------------------------
+	The state of one call to parse(). It lives on
+	parse()'s stack, so separate threads may parse
+	at the same time.
+---------------------------------------------------*/
+typedef struct parserContext
+{
+	char *Str;
+	char *Start_str;
+	char err1Message[255];
+	char err2Message[255];
+	int ParseError;
+	int depth;	 /* how deeply nested Str is, see deeper() */
+	TREE *tree;	 /* the tree being built */
+	TREE *block; /* the block of its arena nodes come from */
+} PARSERCTX;
 
 static int getVarID(char *);
-static PARSETREE binOpNode(int, PARSETREE, PARSETREE);
-static PARSETREE unarOpNode(int, PARSETREE);
-static PARSETREE numNode(int, long double);
-static int evalerr(int);
-static long double _eval(PARSETREE);
-static void error(char *);
-static long double step(long double);
-static int match(char *);
-static PARSETREE expr(void);
-static PARSETREE term(void);
-static PARSETREE fact(void);
-static PARSETREE part(void);
-static PARSETREE part2(void);
-static long double myAtof(void);
-static PARSETREE get_constant(void);
-static PARSETREE func(void);
+static unsigned long hashName(char *, int);
+static int findVar(char *, int);
+static int rehash(int);
+static int varChar(int);
+static int findFunc(char *, int);
+static int namedNumber(char *, int, long double *);
+static int fitCtx(EVALCTX *);
+static PARSETREE *spine(PARSETREE, PARSETREE *, int *);
+static TREE *newBlock(int);
+static void freeTree(TREE *);
+static void release(struct cacheEntry *);
+static PARSETREE newNode(PARSERCTX *);
+static PARSETREE binOpNode(PARSERCTX *, int, PARSETREE, PARSETREE);
+static PARSETREE unarOpNode(PARSERCTX *, int, PARSETREE);
+static PARSETREE numNode(PARSERCTX *, int, long double);
+static long double numValue(PARSETREE);
+static void setNum(PARSETREE, long double);
+static int evalerr(EVALCTX *, int);
+static long double _eval(EVALCTX *, PARSETREE);
+static void error(PARSERCTX *, char *);
+static long double step(EVALCTX *, long double);
+static int match(PARSERCTX *, char *);
+static PARSETREE expr(PARSERCTX *);
+static int deeper(PARSERCTX *);
+static int binop(PARSERCTX *);
+static int digitValue(int, int);
+static long double myAtof(PARSERCTX *);
+static PARSETREE get_constant(PARSERCTX *);
+static PARSETREE func(PARSERCTX *);
+static int isConst(PARSETREE, long double);
+static int canFail(PARSETREE);
+static PARSETREE leaf(PARSETREE, long double);
+static PARSETREE keep(PARSETREE, PARSETREE);
+static PARSETREE fold(EVALCTX *, PARSETREE);
+static PARSETREE simplify(PARSETREE);
+static void countNodes(PARSETREE, int *, int *);
+static int binOpcode(int);
+static int unOpcode(int);
+static int cons(PARSETREE, DAG *, int, int, int, int);
+static int number(PARSETREE, DAG *, int *);
+static int newDag(PARSETREE *, int, DAG *, int, int *);
+static void freeDag(DAG *);
+static void incrOp(EVALCTX *, INCR *, INODE *);
+static int emit(PARSETREE, DAG *, PROGRAM *, INSTR **, int, int *);
+static void batchBlock(EVALCTX *, PROGRAM *, int, const double *, double *,
+					   int *, size_t, double *);
+static PARSETREE dTree(PARSERCTX *, PARSETREE, int);
 
 /************************.variable handling stuff.************************\
 
 	getVarID( char *s ) returns the index of the variable named by the
 	string 's' in the array VARIABLE[]. The value of the variable can
-	then be found at any time with VARIABLE[ id ].val.
+	then be found at any time with ctx->val[ id ].
 
 	SetVariable( char *s, long double v ) calls getVarID to find the variable
 	and then it sets the value of the named variable to the value of 'v'.
-
-	Both routines return 9999 if the variable does not exist.
+	setVariableCtx( void *ctx, char *s, long double v ) does the same in
+	a context made by newEvalCtx().
+
+	Both routines return VarNotFound if the variable does not exist.
+
+	defineVariable( char *s, long double v ) adds a variable named s,
+	which new contexts and the default one start at v. A name is a
+	letter followed by letters, digits or '_' and it may not be that
+	of a function, inf or nan. If s is already a variable only its
+	starting value is changed. It returns the variable's handle, or
+	VarNotFound for a bad name or when there is no memory. Trees parsed before a variable
+	is defined do not see it. Variables are shared by every context, so
+	they should be defined before other threads parse or evaluate.
+
+	getVarHandle( char *s ) returns the handle of a variable, which
+	stays the same for as long as the program runs, or VarNotFound.
+	setVariableByHandle( int h, long double v ) and
+	setVariableByHandleCtx( void *ctx, int h, long double v ) set it
+	without looking up the name. They return h, or VarNotFound if h is
+	not a handle.
+
+	newEvalCtx() returns a new evaluation context, or NULL if there is
+	no memory for it, with the variables at their starting values.
+	Dispose of it with disposEvalCtx().
 
 \*-----------------------------------------------------------------------*/
 
-static int getVarID(char *s)
+static unsigned long hashName(char *s, int len)
+{
+	unsigned long h = 2166136261UL;
+	int i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)s[i]) * 16777619UL;
+	return (h);
+}
+
+/*---------------------------------------------------
+	rehash() fills a VarHash[] of size entries from
+	VARIABLE[], returning -1 if there is no memory.
+---------------------------------------------------*/
+static int rehash(int size)
 {
-	int i = 0;
+	int *table, i, k;
 
-	while (i < num_var)
+	if (size <= (int)(sizeof(HashStart) / sizeof(int)))
 	{
-		if (strcmp(s, VARIABLE[i].name) == 0)
-		{
-			break;
-		}
-		else
-		{
-			i++;
-		}
+		table = HashStart;
+		size = sizeof(HashStart) / sizeof(int);
 	}
+	else if ((table = (int *)malloc(size * sizeof(int))) == NULL)
+		return (-1);
 
-	if (i < num_var)
+	memset(table, 0, size * sizeof(int));
+	for (i = 0; i < num_var; i++)
 	{
-		return (i);
+		k = hashName(VARIABLE[i].name, strlen(VARIABLE[i].name)) &
+			(size - 1);
+		while (table[k])
+			k = (k + 1) & (size - 1);
+		table[k] = i + 1;
 	}
-	else
+
+	if (VarHash != HashStart && VarHash != table)
+		free(VarHash);
+	VarHash = table;
+	hashSize = size;
+	return (0);
+}
+
+/*---------------------------------------------------
+	findVar() looks up the len characters at s.
+---------------------------------------------------*/
+static int findVar(char *s, int len)
+{
+	int i, k;
+
+	if (hashSize == 0)
 	{
+		/* only the built in variables, VarHash[] is not filled yet */
+		for (i = 0; i < num_var; i++)
+			if (strncmp(VARIABLE[i].name, s, len) == 0 &&
+				VARIABLE[i].name[len] == '\0')
+				return (i);
 		return (VarNotFound);
 	}
+
+	k = hashName(s, len) & (hashSize - 1);
+	while ((i = VarHash[k]) != 0)
+	{
+		i--;
+		if (strncmp(VARIABLE[i].name, s, len) == 0 &&
+			VARIABLE[i].name[len] == '\0')
+			return (i);
+		k = (k + 1) & (hashSize - 1);
+	}
+
+	return (VarNotFound);
 }
 
-int setVariable(char *s, long double v)
+static int varChar(int ch)
+{
+	return ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+			isdigit(ch) || ch == '_');
+}
+
+static int getVarID(char *s)
+{
+	return (findVar(s, strlen(s)));
+}
+
+/*---------------------------------------------------
+	fitCtx() makes room in c for every variable,
+	starting the new ones at their starting values.
+---------------------------------------------------*/
+static int fitCtx(EVALCTX *c)
+{
+	long double *val;
+	int i;
+
+	if (c->val == DefaultVal)
+	{
+		val = (long double *)malloc(num_var * sizeof(long double));
+		if (val != NULL)
+			memcpy(val, DefaultVal, sizeof(DefaultVal));
+	}
+	else
+		val = (long double *)realloc(c->val, num_var * sizeof(long double));
+
+	if (val == NULL)
+		return (-1);
+
+	for (i = c->nval; i < num_var; i++)
+		val[i] = VARIABLE[i].val;
+	c->val = val;
+	c->nval = num_var;
+	return (0);
+}
+
+int setVariableCtx(void *ctx, char *s, long double v)
 {
 	int id;
 
 	id = getVarID(s);
 
-	if (id != VarNotFound)
+	if (id != VarNotFound && !FITCTX((EVALCTX *)ctx))
 	{
-		VARIABLE[id].val = v;
+		((EVALCTX *)ctx)->val[id] = v;
 		return (id);
 	}
 	else
@@ -249,25 +630,198 @@ int setVariable(char *s, long double v)
 	}
 }
 
+int setVariable(char *s, long double v)
+{
+	return (setVariableCtx(&DefaultCtx, s, v));
+}
+
+int defineVariable(char *s, long double v)
+{
+	VarType *var;
+	char *name;
+	int i, len;
+
+	len = strlen(s);
+	if (!((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')))
+		return (VarNotFound);
+	for (i = 1; i < len; i++)
+		if (!varChar(s[i]))
+			return (VarNotFound);
+	if (findFunc(s, len) != NoOp || namedNumber(s, len, &v))
+		return (VarNotFound);
+
+	if ((i = getVarID(s)) != VarNotFound)
+	{
+		VARIABLE[i].val = v;
+		DefaultCtx.val[i] = v;
+		return (i);
+	}
+
+	if (num_var == max_var)
+	{
+		if (VARIABLE == Builtin)
+		{
+			var = (VarType *)malloc(2 * max_var * sizeof(VarType));
+			if (var != NULL)
+				memcpy(var, Builtin, sizeof(Builtin));
+		}
+		else
+			var = (VarType *)realloc(VARIABLE, 2 * max_var * sizeof(VarType));
+		if (var == NULL)
+			return (VarNotFound);
+		VARIABLE = var;
+		max_var *= 2;
+	}
+
+	name = (char *)malloc(len + 1);
+	if (name == NULL)
+		return (VarNotFound);
+	strcpy(name, s);
+
+	VARIABLE[num_var].name = name;
+	VARIABLE[num_var].val = v;
+	num_var++;
+
+	if (FITCTX(&DefaultCtx) ||
+		(2 * num_var > hashSize && rehash(2 * hashSize)))
+	{
+		num_var--;
+		free(name);
+		return (VarNotFound);
+	}
+
+	/*---------------------------------------------------
+		Unless rehash() was just called, and it is for
+		the first variable defined, the name goes in here.
+	---------------------------------------------------*/
+	i = hashName(s, len) & (hashSize - 1);
+	while (VarHash[i] && VarHash[i] != num_var)
+		i = (i + 1) & (hashSize - 1);
+	VarHash[i] = num_var;
+
+	DefaultCtx.val[num_var - 1] = v;
+	return (num_var - 1);
+}
+
+int getVarHandle(char *s)
+{
+	return (getVarID(s));
+}
+
+int setVariableByHandleCtx(void *ctx, int h, long double v)
+{
+	EVALCTX *c;
+
+	c = (EVALCTX *)ctx;
+
+	if (h < 0 || h >= num_var || FITCTX(c))
+		return (VarNotFound);
+
+	c->val[h] = v;
+	return (h);
+}
+
+int setVariableByHandle(int h, long double v)
+{
+	return (setVariableByHandleCtx(&DefaultCtx, h, v));
+}
+
+void *newEvalCtx(void)
+{
+	EVALCTX *c;
+	int i;
+
+	c = (EVALCTX *)malloc(sizeof(EVALCTX));
+
+	if (c != NULL)
+	{
+		c->val = (long double *)malloc(num_var * sizeof(long double));
+		if (c->val == NULL)
+		{
+			free(c);
+			return (NULL);
+		}
+		for (i = 0; i < num_var; i++)
+			c->val[i] = VARIABLE[i].val;
+		c->nval = num_var;
+		c->EvalErr = 0;
+	}
+
+	return ((void *)c);
+}
+
+void disposEvalCtx(void *ctx)
+{
+	if (ctx != NULL)
+		free(((EVALCTX *)ctx)->val);
+	free(ctx);
+}
+
 /************************ noderoutines  **********************************\
-	A union should be used to avoid wasting space. When the left/right
+	A union is used to avoid wasting space. When the left/right
 	fields are in use the oprand field is not, and vise-versa.
+
+	The nodes are handed out in turn from the arena of the tree being
+	parsed. parse() sizes the first block from the length of the
+	expression so that most trees fit in it, and another block is
+	chained on whenever one runs out. Nodes are never freed one at a
+	time, disposParseTree() frees the tree and all of its nodes together.
+	A tree from cacheParse() is only given back to its cache.
 \*-----------------------------------------------------------------------*/
 void disposParseTree(void *p)
 {
-	PARSETREE n;
+	if (p != NULL && ((TREE *)p)->cached != NULL)
+		release(((TREE *)p)->cached);
+	else
+		freeTree((TREE *)p);
+}
 
-	n = (PARSETREE)p;
+static void freeTree(TREE *t)
+{
+	TREE *next;
 
-	if (n != NULL)
+	for (; t != NULL; t = next)
 	{
-		disposParseTree(n->left);
-		disposParseTree(n->right);
-		free(n);
+		next = t->next;
+		free(t);
+	}
+}
+
+static TREE *newBlock(int size)
+{
+	TREE *t;
+
+	t = (TREE *)malloc(TREEHDR + size * sizeof(node));
+
+	if (t != NULL)
+	{
+		t->root = NULL;
+		t->next = NULL;
+		t->used = 0;
+		t->size = size;
+		t->cached = NULL;
+	}
+	return (t);
+}
+
+static PARSETREE newNode(PARSERCTX *c)
+{
+	TREE *t;
+
+	t = c->block;
+
+	if (t->used == t->size)
+	{
+		t->next = newBlock(TREEBLOCK);
+		if (t->next == NULL)
+			return (NULL);
+		c->block = t = t->next;
 	}
+	return (TREENODES(t) + t->used++);
 }
 
-static PARSETREE binOpNode(int opor, PARSETREE lopand, PARSETREE ropand)
+static PARSETREE binOpNode(PARSERCTX *c, int opor, PARSETREE lopand,
+						   PARSETREE ropand)
 {
 	PARSETREE n = NULL;
 
@@ -277,21 +831,20 @@ static PARSETREE binOpNode(int opor, PARSETREE lopand, PARSETREE ropand)
 	}
 	else
 	{
-		n = (PARSETREE)malloc(sizeof(node));
+		n = newNode(c);
 		if (n != NULL)
 		{
 			n->type = BINOP;
 			n->opratorid = opor;
-			n->left = lopand;
-			n->right = ropand;
-			n->oprand = (long double)0.0;
+			LEFT(n) = lopand;
+			RIGHT(n) = ropand;
 		}
 	}
 
 	return (n);
 }
 
-static PARSETREE unarOpNode(int opor, PARSETREE lopand)
+static PARSETREE unarOpNode(PARSERCTX *c, int opor, PARSETREE lopand)
 {
 	PARSETREE n = NULL;
 
@@ -301,44 +854,108 @@ static PARSETREE unarOpNode(int opor, PARSETREE lopand)
 	}
 	else
 	{
-		n = (PARSETREE)malloc(sizeof(node));
+		n = newNode(c);
 		if (n != NULL)
 		{
 			n->type = UNOP;
 			n->opratorid = opor;
-			n->left = lopand;
-			n->right = NULL;
-			n->oprand = (long double)0.0;
+			LEFT(n) = lopand;
+			RIGHT(n) = NULL;
 		}
 	}
 
 	return (n);
 }
 
-static PARSETREE numNode(int id, long double rand)
+static PARSETREE numNode(PARSERCTX *c, int id, long double rand)
 
 {
 	PARSETREE n = NULL;
 
-	n = (PARSETREE)malloc(sizeof(node));
+	n = newNode(c);
 
 	if (n != NULL)
 	{
 		n->type = NUM;
 		n->opratorid = id;
-		n->left = NULL;
-		n->right = NULL;
-		n->oprand = rand;
+		setNum(n, rand);
 	}
 
 	return (n);
 }
 
+static long double numValue(PARSETREE n)
+{
+	long double v;
+
+	memcpy(&v, n->u.oprand, sizeof(v));
+	return (v);
+}
+
+static void setNum(PARSETREE n, long double v)
+{
+	memcpy(n->u.oprand, &v, sizeof(v));
+}
+
+/*---------------------------------------------------
+	A sum of many terms is a long run of BINOP nodes
+	down the left side of the tree. The routines that
+	walk a tree go down such a run in a loop instead
+	of calling themselves for every node of it, so
+	their C stack does not grow with its length.
+
+	spine() lists n and the BINOP nodes below it on
+	the left, top first. They go in local, which has
+	room for SPINE of them, or in memory from malloc()
+	if there are more, which the caller frees. *len
+	is set to their number. It returns NULL if there
+	is no memory.
+---------------------------------------------------*/
+#define SPINE 16
+
+static PARSETREE *spine(PARSETREE n, PARSETREE *local, int *len)
+{
+	PARSETREE *s, m;
+	int k;
+
+	for (k = 0, m = n; m->type == BINOP; m = LEFT(m))
+	{
+		if (k < SPINE)
+			local[k] = m;
+		k++;
+	}
+	*len = k;
+
+	if (k <= SPINE)
+		return (local);
+
+	s = (PARSETREE *)malloc(k * sizeof(PARSETREE));
+	if (s != NULL)
+		for (k = 0, m = n; m->type == BINOP; m = LEFT(m))
+			s[k++] = m;
+	return (s);
+}
+
 /*********************** tree evaluateing stuff  *************************\
 	Evaluates a PARSETREE created by 'parse()'. If an error occurs
 	ErrorCode is set and the function continues. This should be changed
 	to halt the function on errors. ErrorCode is available to the calling
 	function.
+
+	evalCtx( void *ctx, void *tree, int *err ) evaluates the tree with
+	the variables and error flag of ctx instead of the default ones.
+
+	evalPrec( void *tree, int prec, int *err ) evaluates the same tree
+	with the arithmetic and library functions of another type :
+
+		PREC_FLOAT		float
+		PREC_DOUBLE		double
+		PREC_LONG		long double, with sinl() and so on
+		PREC_DEFAULT	as eval(), long double with sin() and so on
+
+	The value is returned as a long double whatever the type, and the
+	error codes are those of eval(). evalPrecCtx( void *ctx, void *tree,
+	int prec, int *err ) takes the variables from ctx.
 \*-----------------------------------------------------------------------*/
 
 /*---------------------------------------------------
@@ -347,741 +964,7494 @@ static PARSETREE numNode(int id, long double rand)
 ---------------------------------------------------*/
 static long double EPSILON = 5e-16;
 
-static int evalerr(int i)
+static int evalerr(EVALCTX *c, int i)
 {
-	EvalErr = i;
+	c->EvalErr = i;
 	return i;
 }
 
-long double eval(void *p, int *err_num)
+long double evalCtx(void *ctx, void *p, int *err_num)
 {
 	long double temp;
+	EVALCTX *c;
 	PARSETREE n;
 
-	n = (PARSETREE)p;
+	c = (EVALCTX *)ctx;
+	n = (p == NULL) ? NULL : ((TREE *)p)->root;
 
 	if (n == NULL)
 	{
 		*err_num = 99; /* set tree-no-good code */
 		return (0);
 	}
+	else if (FITCTX(c))
+	{
+		*err_num = -1;
+		return (0);
+	}
 	else
 	{
-		evalerr(0); /* reset error code */
-		temp = _eval(n);
-		*err_num = EvalErr;
+		evalerr(c, 0); /* reset error code */
+		temp = _eval(c, n);
+		*err_num = c->EvalErr;
 		return (temp);
 	}
 }
 
-static long double _eval(PARSETREE n)
+long double eval(void *p, int *err_num)
+{
+	return (evalCtx(&DefaultCtx, p, err_num));
+}
+
+/*---------------------------------------------------
+	TREEEVAL(name, T, M) defines a tree evaluator
+	that does its arithmetic in T and calls the
+	library function M(sin) for sin and so on. The
+	instances differ only in those two. M(PI) and
+	M(PI2) are the constants in the type of the
+	library functions, for the test of tan().
+---------------------------------------------------*/
+#define MATHF(x) x##f
+#define MATHD(x) x
+#define MATHL(x) x##l
+
+#define PIf ((float)PI)
+#define PI2f ((float)PI2)
+#define PIl ((long double)PI)
+#define PI2l ((long double)PI2)
+
+#define TREEEVAL(name, T, M)                                            \
+	static T name(EVALCTX *c, PARSETREE n)                              \
+	{                                                                   \
+		PARSETREE local[SPINE], *s;                                     \
+		T op1 = 0.0, op2 = 0.0, temp = 0.0;                             \
+		int k, len;                                                     \
+                                                                        \
+		switch (n->type)                                                \
+		{                                                               \
+		case BINOP:                                                     \
+			if ((s = spine(n, local, &len)) == NULL)                    \
+			{                                                           \
+				evalerr(c, -1);                                         \
+				break;                                                  \
+			}                                                           \
+			op1 = name(c, LEFT(s[len - 1]));                            \
+			for (k = len - 1; k >= 0 && !c->EvalErr; k--)               \
+			{                                                           \
+				op2 = name(c, RIGHT(s[k]));                             \
+				if (c->EvalErr)                                         \
+					break;                                              \
+				switch (s[k]->opratorid)                                \
+				{                                                       \
+				case 1:                                                 \
+					op1 = (op1 && op2);                                 \
+					break;                                              \
+				case 2:                                                 \
+					op1 = (op1 || op2);                                 \
+					break;                                              \
+				case 3:                                                 \
+					op1 = (op1 <= op2);                                 \
+					break;                                              \
+				case 4:                                                 \
+					op1 = (op1 < op2);                                  \
+					break;                                              \
+				case 5:                                                 \
+					op1 = (op1 >= op2);                                 \
+					break;                                              \
+				case 6:                                                 \
+					op1 = (op1 > op2);                                  \
+					break;                                              \
+				case 7:                                                 \
+					op1 = (op1 == op2);                                 \
+					break;                                              \
+				case 8:                                                 \
+					op1 = (op1 != op2);                                 \
+					break;                                              \
+				case 9:                                                 \
+					op1 = (op1 + op2);                                  \
+					break;                                              \
+				case 10:                                                \
+					op1 = (op1 - op2);                                  \
+					break;                                              \
+				case 11:                                                \
+					op1 = (op1 * op2);                                  \
+					break;                                              \
+				case 12:                                                \
+					if ((long)op2 == 0)                                 \
+						evalerr(c, 2);                                  \
+					else if ((long)op2 == -1) /* LONG_MIN % -1 traps */ \
+						op1 = 0.0;                                      \
+					else                                                \
+						op1 = (T)((long)op1 % (long)op2);               \
+					break;                                              \
+				case 13:                                                \
+					if (op2 != 0.0)                                     \
+						op1 = (op1 / op2);                              \
+					else                                                \
+						evalerr(c, 2);                                  \
+					break;                                              \
+				case 14:                                                \
+					op1 = M(pow)(op1, op2);                             \
+					break;                                              \
+				case 0:                                                 \
+					evalerr(c, 1);                                      \
+					break;                                              \
+				default:                                                \
+					evalerr(c, 3);                                      \
+					break;                                              \
+				}                                                       \
+			}                                                           \
+			if (s != local)                                             \
+				free(s);                                                \
+			if (!c->EvalErr)                                            \
+				temp = op1;                                             \
+			break;                                                      \
+		case UNOP:                                                      \
+			op1 = name(c, LEFT(n));                                     \
+			if (c->EvalErr)                                             \
+				return (0);                                             \
+			switch (n->opratorid)                                       \
+			{                                                           \
+			case 0:                                                     \
+				return (!op1);                                          \
+			case 10:                                                    \
+				return (-op1);                                          \
+			case 15:                                                    \
+				return (M(sin)(op1));                                   \
+			case 16:                                                    \
+				return (M(cos)(op1));                                   \
+			case 17:                                                    \
+				if (M(fabs)(M(fmod)(op1, M(PI)) - M(PI2)) < EPSILON)    \
+					evalerr(c, 4);                                      \
+				else                                                    \
+					temp = M(tan)(op1);                                 \
+				break;                                                  \
+			case 18:                                                    \
+				return (M(exp)(op1));                                   \
+			case 19:                                                    \
+				if (op1 >= 0.0)                                         \
+					return (M(log10)(op1));                             \
+				evalerr(c, 5);                                          \
+				break;                                                  \
+			case 20:                                                    \
+				if (op1 >= 0.0)                                         \
+					return (M(log)(op1));                               \
+				evalerr(c, 6);                                          \
+				break;                                                  \
+			case 21:                                                    \
+				if (op1 >= 0)                                           \
+					return (M(sqrt)(op1));                              \
+				evalerr(c, 7);                                          \
+				break;                                                  \
+			case 22:                                                    \
+				return ((T)step(c, op1));                               \
+			case 23:                                                    \
+			case 24:                                                    \
+			case 25:                                                    \
+				break;                                                  \
+			default:                                                    \
+				evalerr(c, 8);                                          \
+				break;                                                  \
+			}                                                           \
+			break;                                                      \
+		case NUM:                                                       \
+			if (n->opratorid == CONST)                                  \
+				return ((T)numValue(n));                                \
+			else if (n->opratorid < num_var)                            \
+				return ((T)c->val[n->opratorid]);                       \
+			evalerr(c, 9);                                              \
+			break;                                                      \
+		default:                                                        \
+			evalerr(c, n->type);                                        \
+			break;                                                      \
+		}                                                               \
+		return (temp);                                                  \
+	}
+
+/*---------------------------------------------------
+	_eval() keeps the long double arithmetic and
+	double library functions eval() always had,
+	which is also what the compiled and batch
+	evaluators do.
+---------------------------------------------------*/
+TREEEVAL(_eval, long double, MATHD)
+TREEEVAL(_evalFloat, float, MATHF)
+TREEEVAL(_evalDouble, double, MATHD)
+TREEEVAL(_evalLong, long double, MATHL)
+
+long double evalPrecCtx(void *ctx, void *p, int prec, int *err_num)
 {
-	long double op1 = 0.0, op2 = 0.0, temp = 0.0;
-	//	long double step() ;
+	long double temp;
+	EVALCTX *c;
+	PARSETREE n;
+
+	c = (EVALCTX *)ctx;
+	n = (p == NULL) ? NULL : ((TREE *)p)->root;
 
 	if (n == NULL)
 	{
-		; /* do nothing */
+		*err_num = 99;
+		return (0);
 	}
-	else
+	if (FITCTX(c))
 	{
-		switch (n->type)
-		{
-		case BINOP:
-			op1 = _eval(n->left);
-			if (EvalErr)
-				return (0);
-			op2 = _eval(n->right);
-			if (EvalErr)
-				return (0);
-			temp = 0.0;
-			switch (n->opratorid)
-			{
-			case 0:
-				evalerr(1);
-				break;
-			case 1:
-				temp = (op1 && op2);
-				break;
-			case 2:
-				temp = (op1 || op2);
-				break;
-			case 3:
-				temp = (op1 <= op2);
-				break;
-			case 4:
-				if (op1 < op2)
-					temp = 1.0;
-				break;
-			case 5:
-				temp = (op1 >= op2);
-				break;
-			case 6:
-				temp = (op1 > op2);
-				break;
-			case 7:
-				temp = (op1 == op2);
-				break;
-			case 8:
-				temp = (op1 != op2);
-				break;
-			case 9:
-				temp = (op1 + op2);
-				break;
-			case 10:
-				temp = (op1 - op2);
-				break;
-			case 11:
-				temp = (op1 * op2);
-				break;
-			case 12:
-				temp = (long double)((long)op1 % (long)op2);
-				break;
-			case 13:
-				if (op2 != 0.0)
-				{
-					temp = (op1 / op2);
-				}
-				else
-				{
-					evalerr(2);
-				}
-				break;
-			case 14:
-				temp = pow(op1, op2);
-				break;
-			default:
-				evalerr(3);
-				break;
-			} /* switch( n->opratorid ) */
+		*err_num = -1;
+		return (0);
+	}
+
+	evalerr(c, 0);
+	switch (prec)
+	{
+	case PREC_FLOAT:
+		temp = _evalFloat(c, n);
+		break;
+	case PREC_DOUBLE:
+		temp = _evalDouble(c, n);
+		break;
+	case PREC_LONG:
+		temp = _evalLong(c, n);
+		break;
+	default:
+		temp = _eval(c, n);
+		break;
+	}
+	*err_num = c->EvalErr;
+	return (c->EvalErr ? 0 : temp);
+}
+
+long double evalPrec(void *p, int prec, int *err_num)
+{
+	return (evalPrecCtx(&DefaultCtx, p, prec, err_num));
+}
+
+/*********************** tree optimization  *****************************\
+
+	optimize( void *tree, int *removed ) simplifies a PARSETREE in place
+	and returns it. *removed is set to the number of nodes taken out of
+	the tree. A tree from cacheParse() is shared, so it is returned as
+	it is.
+
+	Subtrees made only of numbers, e and pi are evaluated once and
+	replaced by their value. e and pi are taken at the values they have
+	when optimize() is called, optimizeCtx( void *ctx, void *tree,
+	int *removed ) takes them from ctx. A subtree whose evaluation fails is left
+	as it is, so that eval() still reports the error.
+
+	These identities are then applied :
+
+		x+0, 0+x, x-0, x*1, 1*x, x/1, x^1	->	x
+		x*0, 0*x							->	0
+		x^0									->	1
+
+	The last three are only applied when x cannot set an evaluation
+	error, they would hide it otherwise. They take no account of x being
+	infinite or not a number, and x+0 gives -0 where eval() gave 0.
+
+\*-----------------------------------------------------------------------*/
+
+/*---------------------------------------------------
+	isConst() is true when n is the number v.
+---------------------------------------------------*/
+static int isConst(PARSETREE n, long double v)
+{
+	return (n->type == NUM && n->opratorid == CONST && numValue(n) == v);
+}
+
+/*---------------------------------------------------
+	canFail() is true when evaluating n might set
+	an error. Division by a non zero constant is
+	taken as safe.
+---------------------------------------------------*/
+static int canFail(PARSETREE n)
+{
+	for (;; n = LEFT(n))
+		switch (n->type)
+		{
+		case BINOP:
+			if (n->opratorid == 12 || n->opratorid == 13)
+			{
+				if (RIGHT(n)->type != NUM || RIGHT(n)->opratorid != CONST ||
+					(long)numValue(RIGHT(n)) == 0)
+					return (1);
+			}
+			else if (n->opratorid < 1 || n->opratorid > 14)
+				return (1);
+			if (canFail(RIGHT(n)))
+				return (1);
 			break;
 		case UNOP:
-			op1 = _eval(n->left);
-			if (EvalErr)
-				return (0);
-			switch (n->opratorid)
-			{
-			case 0:
-				temp = !op1;
-				break;
-			case 10:
-				temp = -op1;
-				break;
-			case 15:
-				temp = sin(op1);
-				break;
-			case 16:
-				temp = cos(op1);
-				break;
-			case 17:
-				if (fabs(fmod(op1, PI) - PI2) < EPSILON)
-					evalerr(4);
-				else
-					temp = tan(op1);
-				break;
-			case 18:
-				temp = exp(op1);
-				break;
-			case 19:
-				if (op1 >= 0.0)
-					temp = log10(op1);
-				else
-					evalerr(5);
-				break;
-			case 20:
-				if (op1 >= 0.0)
-					temp = log(op1);
-				else
-					evalerr(6);
-				break;
-			case 21:
-				if (op1 >= 0)
-					temp = sqrt(op1);
-				else
-					evalerr(7);
-				break;
-			case 22:
-				temp = step(op1);
-				break;
-			case 23:
-				break;
-			case 24:
-				break;
-			case 25:
-				break;
-			default:
-				evalerr(8);
-				break;
-			} /* switch( n->opratorid ) */
+			if (n->opratorid == 17 || n->opratorid == 19 ||
+				n->opratorid == 20 || n->opratorid == 21 ||
+				unOpcode(n->opratorid) == OP_ERR)
+				return (1);
 			break;
 		case NUM:
-			if (n->opratorid == CONST)
+			return (n->opratorid != CONST && n->opratorid >= num_var);
+		default:
+			return (1);
+		}
+}
+
+/*---------------------------------------------------
+	leaf() turns n into the number v. keep() returns
+	the child of n that is not drop. The nodes cut
+	out stay in the arena until the tree is freed.
+---------------------------------------------------*/
+static PARSETREE leaf(PARSETREE n, long double v)
+{
+	n->type = NUM;
+	n->opratorid = CONST;
+	setNum(n, v);
+	return (n);
+}
+
+static PARSETREE keep(PARSETREE n, PARSETREE drop)
+{
+	return ((drop == LEFT(n)) ? RIGHT(n) : LEFT(n));
+}
+
+static PARSETREE fold(EVALCTX *c, PARSETREE n)
+{
+	PARSETREE local[SPINE], *s, l;
+	int k, len;
+
+	switch (n->type)
+	{
+	case NUM:
+		if (n->opratorid == getVarID("e") || n->opratorid == getVarID("pi"))
+			leaf(n, c->val[n->opratorid]);
+		return (n);
+	case UNOP:
+		LEFT(n) = fold(c, LEFT(n));
+		return (simplify(n));
+	case BINOP:
+		if ((s = spine(n, local, &len)) == NULL)
+			return (n); /* left as it is */
+		l = fold(c, LEFT(s[len - 1]));
+		for (k = len - 1; k >= 0; k--)
+		{
+			LEFT(s[k]) = l;
+			RIGHT(s[k]) = fold(c, RIGHT(s[k]));
+			l = simplify(s[k]);
+		}
+		if (s != local)
+			free(s);
+		return (l);
+	default:
+		return (n);
+	}
+}
+
+/*---------------------------------------------------
+	simplify() applies the rules above to n, whose
+	operands have been folded already.
+---------------------------------------------------*/
+static PARSETREE simplify(PARSETREE n)
+{
+	PARSETREE l, r;
+	EVALCTX scratch;
+	long double v;
+
+	l = LEFT(n);
+	r = (n->type == BINOP) ? RIGHT(n) : NULL;
+
+	/*---------------------------------------------------
+		step() reads t, so it is never constant. Nothing
+		else reads a variable, so scratch needs no values.
+	---------------------------------------------------*/
+	if (l->type == NUM && l->opratorid == CONST &&
+		(r == NULL || (r->type == NUM && r->opratorid == CONST)) &&
+		!(n->type == UNOP && n->opratorid == 22))
+	{
+		scratch.EvalErr = 0;
+		v = _eval(&scratch, n);
+		if (!scratch.EvalErr)
+			leaf(n, v);
+		return (n);
+	}
+
+	if (r == NULL)
+		return (n);
+
+	switch (n->opratorid)
+	{
+	case 9:
+		if (isConst(r, 0.0))
+			return (keep(n, r));
+		if (isConst(l, 0.0))
+			return (keep(n, l));
+		break;
+	case 10:
+		if (isConst(r, 0.0))
+			return (keep(n, r));
+		break;
+	case 11:
+		if (isConst(r, 1.0))
+			return (keep(n, r));
+		if (isConst(l, 1.0))
+			return (keep(n, l));
+		if ((isConst(r, 0.0) && !canFail(l)) ||
+			(isConst(l, 0.0) && !canFail(r)))
+			return (leaf(n, 0.0));
+		break;
+	case 13:
+		if (isConst(r, 1.0))
+			return (keep(n, r));
+		break;
+	case 14:
+		if (isConst(r, 1.0))
+			return (keep(n, r));
+		if (isConst(r, 0.0) && !canFail(l))
+			return (leaf(n, 1.0));
+		break;
+	}
+
+	return (n);
+}
+
+void *optimizeCtx(void *ctx, void *tree, int *removed)
+{
+	TREE *t;
+	int before = 0, after = 0, nconst = 0;
+
+	t = (TREE *)tree;
+	*removed = 0;
+
+	if (t == NULL || t->cached != NULL)
+		return (t);
+
+	countNodes(t->root, &before, &nconst);
+	t->root = fold((EVALCTX *)ctx, t->root);
+	countNodes(t->root, &after, &nconst);
+	*removed = before - after;
+
+	return ((void *)t);
+}
+
+void *optimize(void *tree, int *removed)
+{
+	return (optimizeCtx(&DefaultCtx, tree, removed));
+}
+
+/*********************** compiled programs  ******************************\
+
+	compile( void *tree, int *err ) lowers a PARSETREE into a flat
+	postfix program. The nodes are laid out in the order _eval() would
+	visit them, so evalCompiled() can run the whole expression with one
+	loop over a contiguous array instead of one call frame and two
+	pointer chases per node.
+
+	A program is a single block of memory holding a header, the
+	constant pool and the code. It contains no pointers, so it may be
+	copied or written out as it is, see writeProgram(). Dispose of it
+	with disposProgram().
+
+	A subexpression that occurs more than once, as sin(t) does in
+	sin(t)*sin(t) + cos(t)*sin(t), is computed only the first time.
+	Its value is saved in a slot with OP_SAVE and the later occurrences
+	become an OP_LOAD of the slot. The tree itself is not changed, so
+	it is still freed with disposParseTree(). Identical constants share
+	one entry of the pool.
+
+	evalCompiled( void *prog, int *err ) returns the same values and
+	sets the same error codes as eval() on the tree it was built from.
+	evalCompiledCtx( void *ctx, void *prog, int *err ) takes the
+	variables from ctx. A program is never written to while it runs,
+	so threads may share one.
+
+\*-----------------------------------------------------------------------*/
+
+/*---------------------------------------------------
+	VMSTACK is the number of stack entries and
+	slots evalCompiled() keeps on the C stack,
+	bigger programs get them from malloc().
+---------------------------------------------------*/
+#define VMSTACK 64
+
+static void countNodes(PARSETREE n, int *ncode, int *nconst)
+{
+	for (; n != NULL; n = (n->type == NUM) ? NULL : LEFT(n))
+	{
+		if (n->type == BINOP)
+			countNodes(RIGHT(n), ncode, nconst);
+		(*ncode)++;
+		if (n->type == NUM && n->opratorid == CONST)
+			(*nconst)++;
+	}
+}
+
+static int binOpcode(int id)
+{
+	static int map[] = {
+		OP_ERR, OP_AND, OP_OR, OP_LE, OP_LT,
+		OP_GE, OP_GT, OP_EQ, OP_NE, OP_ADD,
+		OP_SUB, OP_MUL, OP_MOD, OP_DIV, OP_POW};
+
+	return ((id >= 0 && id <= 14) ? map[id] : OP_ERR);
+}
+
+static int unOpcode(int id)
+{
+	switch (id)
+	{
+	case 0:
+		return (OP_NOT);
+	case 10:
+		return (OP_NEG);
+	case 23:
+	case 24:
+	case 25:
+		return (OP_ZERO);
+	default:
+		return ((id >= 15 && id <= 22) ? OP_SIN + (id - 15) : OP_ERR);
+	}
+}
+
+/*---------------------------------------------------
+	cons() returns the DAGNODE for the tree node n,
+	number i in preorder, whose operands have the
+	DAGNODEs l and r, adding one if no subtree of
+	the same shape has been seen. end is the number
+	of the node after its subtree.
+---------------------------------------------------*/
+static int cons(PARSETREE n, DAG *g, int i, int l, int r, int end)
+{
+	DAGNODE *d;
+	long double val;
+	double k;
+	unsigned long h, bits;
+	int v;
+
+	val = (n->type == NUM) ? numValue(n) : 0.0;
+
+	k = (double)val;
+	bits = 0;
+	memcpy(&bits, &k, sizeof(k) < sizeof(bits) ? sizeof(k) : sizeof(bits));
+	h = (((n->type * 31UL + n->opratorid) * 31UL + l) * 31UL + r) ^ bits;
+	h ^= h >> 17;
+	h *= 0x9e3779b1UL;
+
+	for (h &= g->hsize - 1; (v = g->hash[h]) >= 0; h = (h + 1) & (g->hsize - 1))
+	{
+		d = &g->node[v];
+		if (d->type == n->type && d->opratorid == n->opratorid &&
+			d->left == l && d->right == r && d->oprand == val)
+			break;
+	}
+
+	if (v < 0)
+	{
+		v = g->hash[h] = g->n++;
+		d = &g->node[v];
+		d->type = n->type;
+		d->opratorid = n->opratorid;
+		d->left = l;
+		d->right = r;
+		d->oprand = val;
+		d->refs = 0;
+		d->slot = -1;
+		if (l >= 0)
+			g->node[l].refs++;
+		if (r >= 0)
+			g->node[r].refs++;
+	}
+
+	g->vn[i] = v;
+	g->size[i] = end - i;
+	return (v);
+}
+
+/*---------------------------------------------------
+	number() numbers the subtree n, *pre counts the
+	tree nodes in preorder. The run of BINOP nodes
+	down its left side is listed in g->spine and
+	numbered top first, then they are made into
+	DAGNODEs bottom first, each after its right
+	operand.
+---------------------------------------------------*/
+static int number(PARSETREE n, DAG *g, int *pre)
+{
+	PARSETREE *s, m;
+	int i, k, len, l, r;
+
+	s = g->spine + g->top;
+	for (len = 0, m = n; m->type == BINOP; m = LEFT(m))
+		s[len++] = m;
+	g->top += len;
+	i = *pre;
+	*pre += len + 1;
+
+	l = (m->type == UNOP) ? number(LEFT(m), g, pre) : -1;
+	l = cons(m, g, i + len, l, -1, *pre);
+
+	for (k = len - 1; k >= 0; k--)
+	{
+		r = number(RIGHT(s[k]), g, pre);
+		l = cons(s[k], g, i + k, l, r, *pre);
+	}
+
+	g->top -= len;
+	return (l);
+}
+
+/*---------------------------------------------------
+	emit() writes the code for n at *pc and returns
+	the stack depth reached while evaluating it. An
+	operator node used more than once is saved the
+	first time and loaded after that.
+---------------------------------------------------*/
+static int emit(PARSETREE n, DAG *g, PROGRAM *p, INSTR **pc, int sp,
+				int *pre)
+{
+	PARSETREE *s, m;
+	DAGNODE *v, *vk;
+	int d, d2, k, len, top;
+	INSTR *i;
+
+	top = *pre;
+	v = &g->node[g->vn[*pre]];
+	d = sp + 1;
+
+	if (n->type != NUM && v->slot >= 0)
+	{
+		*pre += g->size[*pre];
+		i = (*pc)++;
+		i->op = OP_LOAD;
+		i->arg = v->slot;
+		return (d);
+	}
+
+	(*pre)++;
+
+	switch (n->type)
+	{
+	case BINOP:
+		/*---------------------------------------------------
+			The left run stops early at a node that has
+			been saved, emit() loads that one.
+		---------------------------------------------------*/
+		s = g->spine + g->top;
+		s[0] = n;
+		for (len = 1, m = LEFT(n);
+			 m->type == BINOP && g->node[g->vn[*pre]].slot < 0; m = LEFT(m))
+		{
+			s[len++] = m;
+			(*pre)++;
+		}
+		g->top += len;
+
+		d = emit(m, g, p, pc, sp, pre);
+		for (k = len - 1; k >= 0; k--)
+		{
+			d2 = emit(RIGHT(s[k]), g, p, pc, sp + 1, pre);
+			if (d2 > d)
+				d = d2;
+			i = (*pc)++;
+			i->op = binOpcode(s[k]->opratorid);
+			i->arg = (s[k]->opratorid == 0) ? 1 : 3;
+
+			vk = &g->node[g->vn[top + k]];
+			if (k > 0 && vk->refs > 1)
 			{
-				temp = n->oprand;
+				vk->slot = g->nslot++;
+				i = (*pc)++;
+				i->op = OP_SAVE;
+				i->arg = vk->slot;
 			}
-			else if (n->opratorid < num_var)
+		}
+
+		g->top -= len;
+		break;
+	case UNOP:
+		d = emit(LEFT(n), g, p, pc, sp, pre);
+		i = (*pc)++;
+		i->op = unOpcode(n->opratorid);
+		i->arg = 8;
+		break;
+	case NUM:
+		i = (*pc)++;
+		if (n->opratorid == CONST)
+		{
+			if (v->slot < 0)
 			{
-				temp = VARIABLE[n->opratorid].val;
+				v->slot = p->nconst;
+				PROGCONST(p)[p->nconst++] = numValue(n);
 			}
-			else
+			i->op = OP_CONST;
+			i->arg = v->slot;
+		}
+		else if (n->opratorid < num_var)
+		{
+			i->op = OP_VAR;
+			i->arg = n->opratorid;
+		}
+		else
+		{
+			i->op = OP_ERR;
+			i->arg = 9;
+		}
+		break;
+	default:
+		i = (*pc)++;
+		i->op = OP_ERR;
+		i->arg = n->type;
+		break;
+	}
+
+	if (n->type != NUM && v->refs > 1)
+	{
+		v->slot = g->nslot++;
+		i = (*pc)++;
+		i->op = OP_SAVE;
+		i->arg = v->slot;
+	}
+
+	return (d);
+}
+
+/*---------------------------------------------------
+	newDag() numbers the count trees n[], of nodes
+	nodes in all, into one g, so that they share
+	their common subtrees, and puts the DAGNODE of
+	each root in root[] if that is not NULL. It is 0
+	if there is no memory. g is freed with freeDag()
+	either way.
+---------------------------------------------------*/
+static int newDag(PARSETREE *n, int count, DAG *g, int nodes, int *root)
+{
+	int i, k, pre;
+
+	for (g->hsize = 16; g->hsize < 2 * nodes; g->hsize *= 2)
+		;
+	g->n = 0;
+	g->nslot = 0;
+	g->node = (DAGNODE *)malloc(nodes * sizeof(DAGNODE));
+	g->hash = (int *)malloc(g->hsize * sizeof(int));
+	g->vn = (int *)malloc(nodes * sizeof(int));
+	g->size = (int *)malloc(nodes * sizeof(int));
+	g->spine = (PARSETREE *)malloc(nodes * sizeof(PARSETREE));
+	g->top = 0;
+
+	if (g->node == NULL || g->hash == NULL || g->vn == NULL ||
+		g->size == NULL || g->spine == NULL)
+		return (0);
+
+	for (i = 0; i < g->hsize; i++)
+		g->hash[i] = -1;
+	pre = 0;
+	for (i = 0; i < count; i++)
+	{
+		k = number(n[i], g, &pre);
+		if (root != NULL)
+			root[i] = k;
+	}
+	return (1);
+}
+
+static void freeDag(DAG *g)
+{
+	free(g->spine);
+	free(g->size);
+	free(g->vn);
+	free(g->hash);
+	free(g->node);
+}
+
+void *compile(void *tree, int *err)
+{
+	PARSETREE n;
+	PROGRAM *p = NULL;
+	INSTR *code, *pc;
+	DAG g;
+	int nodes = 0, nconst = 0, ncode, depth, pre, i;
+
+	n = (tree == NULL) ? NULL : ((TREE *)tree)->root;
+
+	if (n == NULL)
+	{
+		*err = 99; /* tree-no-good, as for eval() */
+		return (NULL);
+	}
+
+	countNodes(n, &nodes, &nconst);
+
+	/*--------------------------------------------------
+		Each DAGNODE is emitted once, plus a save and
+		a load per extra use, so the code is never
+		more than twice the tree.
+	--------------------------------------------------*/
+	code = (INSTR *)malloc((2 * nodes + 1) * sizeof(INSTR));
+
+	if (!newDag(&n, 1, &g, nodes, NULL) || code == NULL)
+		goto done;
+
+	for (nconst = 0, i = 0; i < g.n; i++)
+		if (g.node[i].type == NUM && g.node[i].opratorid == CONST)
+			nconst++;
+
+	p = (PROGRAM *)malloc(PROGHDR + nconst * sizeof(long double) +
+						  (2 * nodes + 1) * sizeof(INSTR));
+	if (p == NULL)
+		goto done;
+
+	p->nconst = 0;
+	pc = code;
+	pre = 0;
+	depth = emit(n, &g, p, &pc, 0, &pre);
+	pc->op = OP_END;
+	pc->arg = 0;
+	ncode = (int)(pc - code) + 1;
+
+	p->ncode = ncode;
+	p->depth = depth;
+	p->nslot = g.nslot;
+	p->mapped = 0;
+	memcpy(PROGCODE(p), code, ncode * sizeof(INSTR));
+
+done:
+	free(code);
+	freeDag(&g);
+
+	*err = (p == NULL) ? -1 : 0;
+	return ((void *)p);
+}
+
+void disposProgram(void *prog)
+{
+	if (prog != NULL && !((PROGRAM *)prog)->mapped)
+		free(prog);
+}
+
+/*---------------------------------------------------
+	With GNU C the interpreter jumps straight from
+	one op to the next through a table of label
+	addresses, otherwise it falls back to a switch.
+---------------------------------------------------*/
+#if defined(__GNUC__)
+#define THREADED 1
+#else
+#define THREADED 0
+#endif
+
+long double evalCompiledCtx(void *ctx, void *prog, int *err_num)
+{
+	EVALCTX *c;
+	PROGRAM *p;
+	INSTR *pc;
+	long double local[VMSTACK], *stack, *sp, *k, *slot;
+	long double op1, op2, temp = 0.0;
+	int code = 0;
+
+	c = (EVALCTX *)ctx;
+	p = (PROGRAM *)prog;
+
+	if (p == NULL)
+	{
+		*err_num = 99;
+		return (0);
+	}
+	if (FITCTX(c))
+	{
+		*err_num = -1;
+		return (0);
+	}
+
+	stack = local;
+	if (p->depth + p->nslot > VMSTACK)
+	{
+		stack = (long double *)malloc((p->depth + p->nslot) *
+									  sizeof(long double));
+		if (stack == NULL)
+		{
+			*err_num = -1;
+			return (0);
+		}
+	}
+
+	k = PROGCONST(p);
+	pc = PROGCODE(p);
+	sp = stack - 1;
+	slot = stack + p->depth;
+
+#if THREADED
+#define X(op) &&L_##op,
+	static void *dispatch[] = {OPCODES};
+#undef X
+#define VMCASE(op) L_##op
+#define VMNEXT goto *dispatch[(++pc)->op]
+	goto *dispatch[pc->op];
+#else
+#define VMCASE(op) case op
+#define VMNEXT \
+	pc++;      \
+	continue
+	for (;;)
+		switch (pc->op)
+		{
+#endif
+
+#define BINARY(expr) \
+	op2 = *sp--;     \
+	op1 = *sp;       \
+	*sp = (expr);    \
+	VMNEXT
+
+	VMCASE(OP_CONST):
+		*++sp = k[pc->arg];
+		VMNEXT;
+	VMCASE(OP_VAR):
+		*++sp = c->val[pc->arg];
+		VMNEXT;
+	VMCASE(OP_AND):
+		BINARY(op1 && op2);
+	VMCASE(OP_OR):
+		BINARY(op1 || op2);
+	VMCASE(OP_LE):
+		BINARY(op1 <= op2);
+	VMCASE(OP_LT):
+		BINARY(op1 < op2);
+	VMCASE(OP_GE):
+		BINARY(op1 >= op2);
+	VMCASE(OP_GT):
+		BINARY(op1 > op2);
+	VMCASE(OP_EQ):
+		BINARY(op1 == op2);
+	VMCASE(OP_NE):
+		BINARY(op1 != op2);
+	VMCASE(OP_ADD):
+		BINARY(op1 + op2);
+	VMCASE(OP_SUB):
+		BINARY(op1 - op2);
+	VMCASE(OP_MUL):
+		BINARY(op1 * op2);
+	VMCASE(OP_MOD):
+		if ((long)*sp == 0)
+		{
+			code = 2;
+			goto fail;
+		}
+		BINARY(((long)op2 == -1) ? 0.0
+								 : (long double)((long)op1 % (long)op2));
+	VMCASE(OP_DIV):
+		if (*sp == 0.0)
+		{
+			code = 2;
+			goto fail;
+		}
+		BINARY(op1 / op2);
+	VMCASE(OP_POW):
+		BINARY(pow(op1, op2));
+	VMCASE(OP_NOT):
+		*sp = !*sp;
+		VMNEXT;
+	VMCASE(OP_NEG):
+		*sp = -*sp;
+		VMNEXT;
+	VMCASE(OP_SIN):
+		*sp = sin(*sp);
+		VMNEXT;
+	VMCASE(OP_COS):
+		*sp = cos(*sp);
+		VMNEXT;
+	VMCASE(OP_TAN):
+		if (fabs(fmod(*sp, PI) - PI2) < EPSILON)
+		{
+			code = 4;
+			goto fail;
+		}
+		*sp = tan(*sp);
+		VMNEXT;
+	VMCASE(OP_EXP):
+		*sp = exp(*sp);
+		VMNEXT;
+	VMCASE(OP_LOG):
+		if (!(*sp >= 0.0))
+		{
+			code = 5;
+			goto fail;
+		}
+		*sp = log10(*sp);
+		VMNEXT;
+	VMCASE(OP_LN):
+		if (!(*sp >= 0.0))
+		{
+			code = 6;
+			goto fail;
+		}
+		*sp = log(*sp);
+		VMNEXT;
+	VMCASE(OP_SQRT):
+		if (!(*sp >= 0.0))
+		{
+			code = 7;
+			goto fail;
+		}
+		*sp = sqrt(*sp);
+		VMNEXT;
+	VMCASE(OP_STEP):
+		*sp = step(c, *sp);
+		VMNEXT;
+	VMCASE(OP_ZERO):
+		*sp = 0.0;
+		VMNEXT;
+	VMCASE(OP_SAVE):
+		slot[pc->arg] = *sp;
+		VMNEXT;
+	VMCASE(OP_LOAD):
+		*++sp = slot[pc->arg];
+		VMNEXT;
+	VMCASE(OP_ERR):
+		code = pc->arg;
+		goto fail;
+	VMCASE(OP_END):
+		temp = *sp;
+		goto done;
+
+#if !THREADED
+		}
+#endif
+#undef BINARY
+#undef VMCASE
+#undef VMNEXT
+
+fail:
+	temp = 0.0;
+done:
+	if (stack != local)
+		free(stack);
+	*err_num = code;
+	return (temp);
+}
+
+long double evalCompiled(void *prog, int *err_num)
+{
+	return (evalCompiledCtx(&DefaultCtx, prog, err_num));
+}
+
+/*********************** incremental evaluation  ***********************\
+
+	newIncremental( void *tree, int *err ) makes an evaluator for the
+	tree that keeps the value of every subexpression from one call to
+	the next, or returns NULL and sets *err as compile() does. It holds
+	no pointer into the tree, which may be disposed of.
+
+	evalIncremental( void *incr, int *err ) and evalIncrementalCtx(
+	void *ctx, void *incr, int *err ) return what eval() would. The
+	variables are compared with those of the last call and only the
+	subexpressions that depend on one that has changed are worked out
+	again, so when a variable or two change between calls the cost is
+	that of the part of the expression they reach. step() depends on t
+	as well as its operand. The subexpressions are shared as compile()
+	shares them, so each is worked out once per call.
+
+	An evaluator changes as it is used, so each thread needs its own.
+	Dispose of it with disposIncremental().
+
+\*-----------------------------------------------------------------------*/
+
+/*---------------------------------------------------
+	Which variables a subexpression depends on is
+	kept as a mask of bits, variable id modulo the
+	bits in a long. Variables that share a bit only
+	cost some needless work.
+---------------------------------------------------*/
+#define DEPBIT(id) (1UL << ((id) % (8 * sizeof(unsigned long))))
+#define STALE(x, i, changed) \
+	(((x)->node[i].dep & (changed)) != 0 && (x)->node[i].gen != (x)->gen)
+
+/*---- sets d->val and d->err from its operands, as _eval() would ----*/
+static void incrOp(EVALCTX *c, INCR *x, INODE *d)
+{
+	long double op1 = 0.0, op2 = 0.0;
+
+	if (d->left >= 0 && (d->err = x->node[d->left].err) != 0)
+		return;
+	if (d->right >= 0 && (d->err = x->node[d->right].err) != 0)
+		return;
+	if (d->left >= 0)
+		op1 = x->node[d->left].val;
+	if (d->right >= 0)
+		op2 = x->node[d->right].val;
+
+	switch (d->op)
+	{
+	case OP_VAR:
+		d->val = c->val[d->arg];
+		break;
+	case OP_AND:
+		d->val = (op1 && op2);
+		break;
+	case OP_OR:
+		d->val = (op1 || op2);
+		break;
+	case OP_LE:
+		d->val = (op1 <= op2);
+		break;
+	case OP_LT:
+		d->val = (op1 < op2);
+		break;
+	case OP_GE:
+		d->val = (op1 >= op2);
+		break;
+	case OP_GT:
+		d->val = (op1 > op2);
+		break;
+	case OP_EQ:
+		d->val = (op1 == op2);
+		break;
+	case OP_NE:
+		d->val = (op1 != op2);
+		break;
+	case OP_ADD:
+		d->val = op1 + op2;
+		break;
+	case OP_SUB:
+		d->val = op1 - op2;
+		break;
+	case OP_MUL:
+		d->val = op1 * op2;
+		break;
+	case OP_MOD:
+		if ((long)op2 == 0)
+			d->err = 2;
+		else if ((long)op2 == -1) /* LONG_MIN % -1 traps */
+			d->val = 0.0;
+		else
+			d->val = (long double)((long)op1 % (long)op2);
+		break;
+	case OP_DIV:
+		if (op2 == 0.0)
+			d->err = 2;
+		else
+			d->val = op1 / op2;
+		break;
+	case OP_POW:
+		d->val = pow(op1, op2);
+		break;
+	case OP_NOT:
+		d->val = !op1;
+		break;
+	case OP_NEG:
+		d->val = -op1;
+		break;
+	case OP_SIN:
+		d->val = sin(op1);
+		break;
+	case OP_COS:
+		d->val = cos(op1);
+		break;
+	case OP_TAN:
+		if (fabs(fmod(op1, PI) - PI2) < EPSILON)
+			d->err = 4;
+		else
+			d->val = tan(op1);
+		break;
+	case OP_EXP:
+		d->val = exp(op1);
+		break;
+	case OP_LOG:
+		if (op1 >= 0.0)
+			d->val = log10(op1);
+		else
+			d->err = 5;
+		break;
+	case OP_LN:
+		if (op1 >= 0.0)
+			d->val = log(op1);
+		else
+			d->err = 6;
+		break;
+	case OP_SQRT:
+		if (op1 >= 0.0)
+			d->val = sqrt(op1);
+		else
+			d->err = 7;
+		break;
+	case OP_STEP:
+		d->val = step(c, op1);
+		break;
+	case OP_ZERO:
+		d->val = 0.0;
+		break;
+	default: /* OP_ERR */
+		d->err = d->arg;
+		break;
+	}
+}
+
+/*---------------------------------------------------
+	newIncr() makes the INCR of the count trees t[],
+	or NULL with *err set.
+---------------------------------------------------*/
+static INCR *newIncr(void **t, int count, int *err)
+{
+	PARSETREE *n;
+	INCR *x;
+	INODE *d;
+	DAGNODE *v;
+	DAG g;
+	int nodes = 0, nconst = 0, i, k, step = 0;
+
+	*err = -1;
+	n = (PARSETREE *)malloc(count * sizeof(PARSETREE));
+	x = (INCR *)calloc(1, sizeof(INCR));
+	if (n == NULL || x == NULL ||
+		(x->root = (int *)malloc(count * sizeof(int))) == NULL)
+	{
+		free(n);
+		free(x);
+		return (NULL);
+	}
+	x->nroot = count;
+
+	for (i = 0; i < count; i++)
+	{
+		n[i] = (t[i] == NULL) ? NULL : ((TREE *)t[i])->root;
+		if (n[i] == NULL)
+		{
+			*err = 99;
+			free(n);
+			disposIncremental(x);
+			return (NULL);
+		}
+		countNodes(n[i], &nodes, &nconst);
+	}
+
+	i = newDag(n, count, &g, nodes, x->root);
+	free(n);
+	if (!i)
+	{
+		freeDag(&g);
+		disposIncremental(x);
+		return (NULL);
+	}
+
+	/*---------------------------------------------------
+		number() makes each DAGNODE after its operands,
+		so they can be copied over in order.
+	---------------------------------------------------*/
+	x->n = g.n;
+	x->node = (INODE *)malloc(g.n * sizeof(INODE));
+	x->stack = (int *)malloc((2 * g.n + count) * sizeof(int));
+	x->var = (int *)malloc((g.n + 1) * sizeof(int));
+	x->was = (long double *)malloc((g.n + 1) * sizeof(long double));
+	if (x->node == NULL || x->stack == NULL || x->var == NULL ||
+		x->was == NULL)
+	{
+		freeDag(&g);
+		disposIncremental(x);
+		return (NULL);
+	}
+
+	for (i = 0; i < g.n; i++)
+	{
+		v = &g.node[i];
+		d = &x->node[i];
+		d->left = v->left;
+		d->right = v->right;
+		d->arg = 0;
+		d->dep = 0;
+		d->gen = 0;
+		d->seen = 0;
+		d->err = 0;
+		d->val = 0.0;
+
+		switch (v->type)
+		{
+		case BINOP:
+			d->op = binOpcode(v->opratorid);
+			d->arg = (v->opratorid == 0) ? 1 : 3;
+			break;
+		case UNOP:
+			d->op = unOpcode(v->opratorid);
+			d->arg = 8;
+			break;
+		case NUM:
+			if (v->opratorid == CONST)
+			{
+				d->op = OP_CONST;
+				d->val = v->oprand;
+			}
+			else if (v->opratorid < num_var)
+			{
+				d->op = OP_VAR;
+				d->arg = v->opratorid;
+				d->dep = DEPBIT(v->opratorid);
+				x->var[x->nvar++] = v->opratorid;
+			}
+			else
+			{
+				d->op = OP_ERR;
+				d->arg = 9;
+			}
+			break;
+		default:
+			d->op = OP_ERR;
+			d->arg = v->type;
+			break;
+		}
+
+		if (d->left >= 0)
+			d->dep |= x->node[d->left].dep;
+		if (d->right >= 0)
+			d->dep |= x->node[d->right].dep;
+		if (d->op == OP_STEP)
+		{
+			d->dep |= DEPBIT(0);
+			step = 1;
+		}
+		for (k = 0; k < (int)(8 * sizeof(unsigned long)); k++)
+			if ((d->dep & (1UL << k)) != 0)
+				x->uses[k]++;
+
+		/*---- what depends on no variable is worked out now ----*/
+		if (d->dep == 0 && d->op != OP_CONST)
+			incrOp(&DefaultCtx, x, d);
+	}
+
+	/*---- step() reads t, so t is watched too ----*/
+	if (step)
+	{
+		for (k = 0; k < x->nvar && x->var[k] != 0; k++)
+			;
+		if (k == x->nvar)
+			x->var[x->nvar++] = 0;
+	}
+
+	freeDag(&g);
+	*err = 0;
+	return (x);
+}
+
+void *newIncremental(void *tree, int *err)
+{
+	return ((void *)newIncr(&tree, 1, err));
+}
+
+/*---------------------------------------------------
+	incrUpdate() brings every root of x up to date
+	with the variables in c.
+---------------------------------------------------*/
+static void incrUpdate(EVALCTX *c, INCR *x)
+{
+	INODE *d;
+	unsigned long changed = 0;
+	long double v;
+	int i, k, sp;
+
+	/*---------------------------------------------------
+		A variable counts as changed unless it is equal
+		to what it was, with the same sign, so going
+		from 0 to -0 is seen and a NaN always is.
+	---------------------------------------------------*/
+	for (i = 0; i < x->nvar; i++)
+	{
+		v = c->val[x->var[i]];
+		if (x->gen == 0 || v != x->was[i] ||
+			signbit(v) != signbit(x->was[i]))
+		{
+			changed |= DEPBIT(x->var[i]);
+			x->was[i] = v;
+		}
+	}
+	if (x->gen == 0)
+		changed = ~0UL;
+	if (changed == 0)
+		return;
+	x->gen++;
+
+	/*---------------------------------------------------
+		When most of the nodes are out of date it is
+		quicker to go through them all in order.
+	---------------------------------------------------*/
+	for (k = 0, i = 0; i < (int)(8 * sizeof(unsigned long)); i++)
+		if ((changed & (1UL << i)) != 0)
+			k += x->uses[i];
+	if (k > x->n / 4)
+	{
+		for (i = 0; i < x->n; i++)
+			if ((x->node[i].dep & changed) != 0)
+				incrOp(c, x, &x->node[i]);
+		return;
+	}
+
+	/*---------------------------------------------------
+		Work out the roots, going down only into the
+		operands that are out of date. A node is seen
+		first with d->seen behind, when its operands
+		are put on the stack, and again once they are
+		done. Each node puts at most two on the stack.
+	---------------------------------------------------*/
+	sp = 0;
+	for (i = 0; i < x->nroot; i++)
+		if (STALE(x, x->root[i], changed))
+			x->stack[sp++] = x->root[i];
+
+	while (sp > 0)
+	{
+		d = &x->node[x->stack[sp - 1]];
+		if (d->gen == x->gen)
+			sp--;
+		else if (d->seen != x->gen)
+		{
+			d->seen = x->gen;
+			if (d->right >= 0 && STALE(x, d->right, changed))
+				x->stack[sp++] = d->right;
+			if (d->left >= 0 && STALE(x, d->left, changed))
+				x->stack[sp++] = d->left;
+		}
+		else
+		{
+			incrOp(c, x, d);
+			d->gen = x->gen;
+			sp--;
+		}
+	}
+}
+
+long double evalIncrementalCtx(void *ctx, void *incr, int *err_num)
+{
+	EVALCTX *c;
+	INCR *x;
+	INODE *d;
+
+	c = (EVALCTX *)ctx;
+	x = (INCR *)incr;
+
+	if (x == NULL)
+	{
+		*err_num = 99;
+		return (0);
+	}
+	if (FITCTX(c))
+	{
+		*err_num = -1;
+		return (0);
+	}
+
+	incrUpdate(c, x);
+	d = &x->node[x->root[0]];
+	evalerr(c, d->err);
+	*err_num = d->err;
+	return (d->err ? 0.0 : d->val);
+}
+
+long double evalIncremental(void *incr, int *err_num)
+{
+	return (evalIncrementalCtx(&DefaultCtx, incr, err_num));
+}
+
+void disposIncremental(void *incr)
+{
+	INCR *x;
+
+	x = (INCR *)incr;
+	if (x == NULL)
+		return;
+	free(x->node);
+	free(x->root);
+	free(x->stack);
+	free(x->var);
+	free(x->was);
+	free(x);
+}
+
+/*********************** many expressions  ******************************\
+
+	newMultiEval( void *trees[], int n, int *err ) puts n trees together
+	into one evaluator, in which a subexpression that occurs in more
+	than one of them, such as sin(t) or t^2, is worked out once for all.
+	It returns NULL and sets *err as compile() does if it cannot.
+
+	evalMulti( void *multi, long double out[], int errs[] ) puts the
+	value of the i'th expression in out[i] and the code eval() would
+	have set in errs[i], if errs is not NULL. An error in one does not
+	stop the others. evalMultiBatch( void *multi, const double *t,
+	double *out, size_t n, int *errs ) does the same for n values of t,
+	the results for t[i] going to out[i * nexpr] on, and afterwards t
+	is as it was. They return 0, 99 for no evaluator or -1 if there is
+	no memory. evalMultiCtx() and evalMultiBatchCtx() take the variables
+	from a context made by newEvalCtx().
+
+	The evaluator is an incremental one, see newIncremental(), so only
+	what depends on variables that changed is worked out again, and
+	expressions that do not read t cost nothing in a batch. Dispose of
+	it with disposMultiEval().
+
+\*-----------------------------------------------------------------------*/
+
+void *newMultiEval(void *trees[], int n, int *err)
+{
+	if (n < 1)
+	{
+		*err = 99;
+		return (NULL);
+	}
+	return ((void *)newIncr(trees, n, err));
+}
+
+int evalMultiCtx(void *ctx, void *multi, long double out[], int errs[])
+{
+	INCR *x;
+	INODE *d;
+	int i;
+
+	x = (INCR *)multi;
+
+	if (x == NULL)
+		return (99);
+	if (FITCTX((EVALCTX *)ctx))
+		return (-1);
+
+	incrUpdate((EVALCTX *)ctx, x);
+	for (i = 0; i < x->nroot; i++)
+	{
+		d = &x->node[x->root[i]];
+		out[i] = d->err ? 0.0 : d->val;
+		if (errs != NULL)
+			errs[i] = d->err;
+	}
+	return (0);
+}
+
+int evalMulti(void *multi, long double out[], int errs[])
+{
+	return (evalMultiCtx(&DefaultCtx, multi, out, errs));
+}
+
+int evalMultiBatchCtx(void *ctx, void *multi, const double *t, double *out,
+					  size_t n, int *errs)
+{
+	EVALCTX *c;
+	INCR *x;
+	INODE *d;
+	long double was;
+	size_t j;
+	int i;
+
+	c = (EVALCTX *)ctx;
+	x = (INCR *)multi;
+
+	if (x == NULL)
+		return (99);
+	if (FITCTX(c))
+		return (-1);
+
+	was = c->val[0];
+	for (j = 0; j < n; j++)
+	{
+		c->val[0] = t[j];
+		incrUpdate(c, x);
+		for (i = 0; i < x->nroot; i++)
+		{
+			d = &x->node[x->root[i]];
+			out[j * x->nroot + i] = d->err ? 0.0 : (double)d->val;
+			if (errs != NULL)
+				errs[j * x->nroot + i] = d->err;
+		}
+	}
+	c->val[0] = was;
+	return (0);
+}
+
+int evalMultiBatch(void *multi, const double *t, double *out, size_t n,
+				   int *errs)
+{
+	return (evalMultiBatchCtx(&DefaultCtx, multi, t, out, n, errs));
+}
+
+void disposMultiEval(void *multi)
+{
+	disposIncremental(multi);
+}
+
+/*********************** vector math kernels  ****************************\
+
+	vSin(), vCos(), vTan(), vExp(), vLog10(), vLn() and vPow()
+	replace the libm calls in batchBlock(). Each works on VLEN = 8
+	doubles at a time using the GNU C vector extensions, which is one
+	AVX-512 register. They are only built for x86-64, with AVX-512
+	switched on for the kernels alone, and batchBlock() calls them
+	only when VHAVE says the CPU has it. Elsewhere it keeps calling
+	libm: split over AVX2 or SSE2 registers GCC works the lane masks
+	one lane at a time, and the kernels come out slower than libm.
+
+	The kernels follow the fdlibm algorithms. Arguments they are not
+	built for (|x| > 2^19*pi/2 for the trig functions, exp() results
+	that overflow or go subnormal, subnormal, negative, zero or
+	non-finite log and pow arguments) are handed back to libm one lane
+	at a time, so special values come out as libm gives them.
+
+	Error, in units in the last place of the double result, measured
+	against long double libm over 10^7 random arguments per function:
+
+		sin, cos		<= 1.5 ulp
+		tan				<= 3.1 ulp
+		exp				<= 1 ulp
+		ln				<= 1.3 ulp
+		log10			<= 2 ulp
+		pow				<= 1.1 ulp
+
+	sqrt is left to libm, which is already a single instruction.
+	The domain checks for tan, log and ln stay in batchBlock(), ahead
+	of the kernels, so the error codes are unchanged.
+
+\*-----------------------------------------------------------------------*/
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define VMATH 1
+#else
+#define VMATH 0
+#endif
+
+#if VMATH
+
+#define VLEN 8
+
+/*---------------------------------------------------
+	The helpers take their vector arguments by
+	pointer, which keeps GCC from warning that
+	passing 64 byte vectors by value depends on
+	AVX-512. They are all inlined, and GCC still
+	warns about returning them.
+---------------------------------------------------*/
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+/*---------------------------------------------------
+	The double-double steps rely on every product
+	being rounded where it is written. GCC would
+	otherwise fuse a*b - p into one FMA and lose
+	the very error term being computed.
+---------------------------------------------------*/
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+typedef double VDBL __attribute__((vector_size(VLEN * sizeof(double))));
+typedef long long VINT __attribute__((vector_size(VLEN * sizeof(long long))));
+typedef unsigned long long VBITS
+	__attribute__((vector_size(VLEN * sizeof(long long))));
+
+#ifdef __AVX512F__
+#define VKERNEL
+#define VHAVE 1
+#else
+#define VKERNEL __attribute__((target("avx512f")))
+#define VHAVE __builtin_cpu_supports("avx512f")
+#endif
+
+#define VINLINE static inline __attribute__((always_inline))
+
+/*---------------------------------------------------
+	VSEL( m, a, b ) takes the lanes of a where the
+	mask m is set and the lanes of b elsewhere.
+	SHIFT rounds a double to an integer when added
+	and subtracted again, and leaves the integer in
+	the low bits of the sum.
+---------------------------------------------------*/
+#define VSEL(m, a, b) ((VDBL)(((VINT)(a) & (m)) | ((VINT)(b) & ~(m))))
+#define VABS(x) ((VDBL)((VBITS)(x) & 0x7fffffffffffffffULL))
+#define SHIFT 0x1.8p52
+
+/*---------------------------------------------------
+	Splits of ln2 and pi/2 into a leading part with
+	enough trailing zero bits that products with
+	small integers are exact, and the remainder.
+---------------------------------------------------*/
+#define INVLN2 1.44269504088896338700e+00
+#define LN2HI 6.93147180369123816490e-01
+#define LN2LO 1.90821492927058770002e-10
+#define LN2DH 0x1.62e42fefa39efp-1
+#define LN2DL 0x1.abc9e3b39803fp-56
+
+#define INVPIO2 6.36619772367581382433e-01
+#define PIO2_1 1.57079632673412561417e+00
+#define PIO2_2 6.07710050630396597660e-11
+#define PIO2_2T 2.02226624879595063154e-21
+#define PIO2_3 2.02226624871116645580e-21
+#define PIO2_3T 8.47842766036889956997e-32
+
+/*---------------------------------------------------
+	Limits held as the bit patterns of positive
+	doubles, which order the same way as the values
+	and compare faster as integers. NaNs are larger
+	than all of them.
+---------------------------------------------------*/
+#define TRIGMAX 0x412921fa00000000LL /* 823549, just under 2^19*pi/2 */
+#define EXPMAX 0x4086200000000000LL	 /* 708 */
+#define INFBITS 0x7ff0000000000000LL
+#define SQRT2BITS 0x3ff6a09e667f3bcdLL
+
+VINLINE int vAny(const VINT *m)
+{
+	long long r = 0;
+	int j;
+
+	for (j = 0; j < VLEN; j++)
+		r |= (*m)[j];
+	return (r != 0);
+}
+
+/*---------------------------------------------------
+	vLoad() and vStore() move up to VLEN doubles,
+	so that a short last chunk of a block goes
+	through the same code as the others.
+---------------------------------------------------*/
+VINLINE VDBL vLoad(const double *x, size_t n)
+{
+	VDBL v = {0};
+
+	if (n >= VLEN)
+		memcpy(&v, x, sizeof(v));
+	else
+		memcpy(&v, x, n * sizeof(double));
+	return (v);
+}
+
+VINLINE void vStore(double *x, const VDBL *v, size_t n)
+{
+	if (n >= VLEN)
+		memcpy(x, v, sizeof(*v));
+	else
+		memcpy(x, v, n * sizeof(double));
+}
+
+/*---------------------------------------------------
+	vFloat() converts small integers held in VINT
+	lanes to doubles, using the SHIFT trick the
+	other way round.
+---------------------------------------------------*/
+VINLINE VDBL vFloat(VINT k)
+{
+	return ((VDBL)(k + 0x4338000000000000LL) - SHIFT);
+}
+
+/*---------------------------------------------------
+	TWOSUM and TWOPROD set hi to a+b and a*b, and lo
+	to what the rounding lost, so that hi + lo is
+	exact (to within 2^-106 for the product).
+	TWOPROD splits its operands by masking off their
+	low 27 bits.
+---------------------------------------------------*/
+#define TWOSUM(a, b, hi, lo)                   \
+	do                                         \
+	{                                          \
+		VDBL a_ = (a), b_ = (b), bb_;          \
+		(hi) = a_ + b_;                        \
+		bb_ = (hi) - a_;                       \
+		(lo) = (a_ - ((hi) - bb_)) + (b_ - bb_); \
+	} while (0)
+
+#define TWOPROD(a, b, hi, lo)                                  \
+	do                                                         \
+	{                                                          \
+		VDBL a_ = (a), b_ = (b), ah_, al_, bh_, bl_;           \
+		ah_ = (VDBL)((VINT)a_ & -0x8000000LL);                 \
+		al_ = a_ - ah_;                                        \
+		bh_ = (VDBL)((VINT)b_ & -0x8000000LL);                 \
+		bl_ = b_ - bh_;                                        \
+		(hi) = a_ * b_;                                        \
+		(lo) = (((ah_ * bh_ - (hi)) + ah_ * bl_) + al_ * bh_) + \
+			   al_ * bl_;                                      \
+	} while (0)
+
+/*---------------------------------------------------
+	vExpCore() returns e^(x + xlo) for |x| <= 708
+	and |xlo| well under 1 ulp of x. The reduced
+	argument |r| <= ln2/2 goes through the Taylor
+	series to r^13.
+---------------------------------------------------*/
+VINLINE VDBL vExpCore(const VDBL *x, const VDBL *xlo)
+{
+	VDBL kd, k, r, p;
+	VBITS scale;
+
+	kd = *x * INVLN2 + SHIFT;
+	k = kd - SHIFT;
+	r = (*x - k * LN2HI) - k * LN2LO + *xlo;
+
+	p = r * (1.0 / 6227020800.0) + 1.0 / 479001600.0;
+	p = p * r + 1.0 / 39916800.0;
+	p = p * r + 1.0 / 3628800.0;
+	p = p * r + 1.0 / 362880.0;
+	p = p * r + 1.0 / 40320.0;
+	p = p * r + 1.0 / 5040.0;
+	p = p * r + 1.0 / 720.0;
+	p = p * r + 1.0 / 120.0;
+	p = p * r + 1.0 / 24.0;
+	p = p * r + 1.0 / 6.0;
+	p = p * r + 0.5;
+	p = 1.0 + (r + r * r * p);
+
+	scale = ((VBITS)kd << 52) + 0x3ff0000000000000ULL;
+	return (p * (VDBL)scale);
+}
+
+/*---------------------------------------------------
+	vLogSplit() writes a normal positive x as
+	2^k * (1 + f), sqrt(2)/2 <= 1 + f < sqrt(2),
+	and returns k as a double.
+---------------------------------------------------*/
+VINLINE VDBL vLogSplit(const VDBL *x, VDBL *f)
+{
+	VBITS bits;
+	VINT k, big;
+	VDBL m;
+
+	bits = (VBITS)*x;
+	k = (VINT)(bits >> 52) - 1023;
+	m = (VDBL)((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+	big = (VINT)m > SQRT2BITS;
+	m = VSEL(big, m * 0.5, m);
+	k = k - big;
+	*f = m - 1.0;
+	return ((VDBL)(k + 0x4338000000000000LL) - SHIFT);
+}
+
+/*---------------------------------------------------
+	vLog1pTail() is fdlibm's log(1 + f) less its
+	leading term f, which the callers add last.
+---------------------------------------------------*/
+VINLINE VDBL vLog1pTail(const VDBL *f)
+{
+	VDBL s, z, w, t1, t2, hfsq;
+
+	s = *f / (2.0 + *f);
+	z = s * s;
+	w = z * z;
+	t1 = w * (3.999999999940941908e-01 +
+			  w * (2.222219843214978396e-01 + w * 1.531383769920937332e-01));
+	t2 = z * (6.666666666666735130e-01 +
+			  w * (2.857142874366239149e-01 +
+				   w * (1.818357216161805012e-01 + w * 1.479819860511658591e-01)));
+	hfsq = 0.5 * *f * *f;
+	return (s * (hfsq + t1 + t2) - hfsq);
+}
+
+/*---------------------------------------------------
+	vLnDD() returns ln(x) as hi + *lo, good to
+	about 2^-64, which pow() needs when y*ln(x) is
+	large. It sums 2*atanh(s), s = f/(2 + f), with
+	the s and s^3 terms in double-double.
+---------------------------------------------------*/
+VINLINE VDBL vLnDD(const VDBL *x, VDBL *lo)
+{
+	VDBL zero = {0};
+	VDBL k, f, d, dlo, s, slo, ph, pl, s2, s2l, s3, s3l, t3, t3l, t5;
+	VDBL hi, l, l2, eh, el;
+
+	k = vLogSplit(x, &f);
+
+	d = 2.0 + f;
+	dlo = (2.0 - d) + f;
+	s = f / d;
+	TWOPROD(s, d, ph, pl);
+	slo = (((f - ph) - pl) - s * dlo) / d;
+
+	TWOPROD(s, s, s2, s2l);
+	s2l = s2l + 2.0 * s * slo;
+	TWOPROD(s2, s, s3, s3l);
+	s3l = s3l + s2l * s + s2 * slo;
+
+	/* 2/3 is 0x1.5555555555555p-1 + 0x1.5555555555555p-55 */
+	TWOPROD(s3, zero + 0x1.5555555555555p-1, t3, t3l);
+	t3l = t3l + s3l * 0x1.5555555555555p-1 + s3 * 0x1.5555555555555p-55;
+
+	t5 = s2 * (2.0 / 23.0) + 2.0 / 21.0;
+	t5 = t5 * s2 + 2.0 / 19.0;
+	t5 = t5 * s2 + 2.0 / 17.0;
+	t5 = t5 * s2 + 2.0 / 15.0;
+	t5 = t5 * s2 + 2.0 / 13.0;
+	t5 = t5 * s2 + 2.0 / 11.0;
+	t5 = t5 * s2 + 2.0 / 9.0;
+	t5 = t5 * s2 + 2.0 / 7.0;
+	t5 = t5 * s2 + 2.0 / 5.0;
+	t5 = t5 * s3 * s2;
+
+	TWOSUM(2.0 * s, t3, hi, l);
+	l = l + 2.0 * slo + t3l + t5;
+
+	TWOPROD(k, zero + LN2DH, eh, el);
+	el = el + k * LN2DL;
+	TWOSUM(eh, hi, hi, l2);
+	l = l + l2 + el;
+
+	TWOSUM(hi, l, hi, *lo);
+	return (hi);
+}
+
+/*---------------------------------------------------
+	vTrig() reduces x by multiples of pi/2 into
+	y0 + y1, |y0| <= pi/4, using three rounds of
+	Cody and Waite, then runs the fdlibm sin and
+	cos kernels. which is 0 for sin, 1 for cos and
+	2 for tan.
+---------------------------------------------------*/
+VINLINE VDBL vTrig(const VDBL *x, int which)
+{
+	VDBL zero = {0};
+	VDBL fn, r, t, w, y0, y1, z, v, p, sn, cs, qx, res;
+	VINT n, odd, bad;
+	int j;
+
+	fn = *x * INVPIO2 + SHIFT;
+	n = (VINT)fn;
+	fn = fn - SHIFT;
+
+	r = *x - fn * PIO2_1;
+	t = r;
+	w = fn * PIO2_2;
+	r = t - w;
+	w = fn * PIO2_2T - ((t - r) - w);
+	t = r;
+	w = fn * PIO2_3;
+	r = t - w;
+	w = fn * PIO2_3T - ((t - r) - w);
+	y0 = r - w;
+	y1 = (r - y0) - w;
+
+	z = y0 * y0;
+	v = z * y0;
+	p = 8.33333333332248946124e-03 +
+		z * (-1.98412698298579493134e-04 +
+			 z * (2.75573137070700676789e-06 +
+				  z * (-2.50507602534068634195e-08 +
+					   z * 1.58969099521155010221e-10)));
+	sn = y0 - ((z * (0.5 * y1 - v * p) - y1) - v * -1.66666666666666324348e-01);
+
+	p = z * (4.16666666666666019037e-02 +
+			 z * (-1.38888888888741095749e-03 +
+				  z * (2.48015872894767294178e-05 +
+					   z * (-2.75573143513906633035e-07 +
+							z * (2.08757232129817482790e-09 +
+								 z * -1.13596475577881948265e-11)))));
+	t = VABS(y0);
+	qx = (VDBL)(((VINT)t - 0x0020000000000000LL) & (long long)0xffffffff00000000ULL);
+	qx = VSEL((VINT)t > 0x3fe9000000000000LL, zero + 0.28125, qx);	/* 0.78125 */
+	qx = VSEL((VINT)t < 0x3fd3333300000000LL, zero, qx);			/* 0.3 */
+	cs = (1.0 - qx) - ((0.5 * z - qx) - (z * p - y0 * y1));
+
+	if (which == 1)
+		n = n + 1;
+	odd = (n & 1) != 0;
+
+	if (which == 2)
+	{
+		res = VSEL(odd, -cs / sn, sn / cs);
+	}
+	else
+	{
+		res = VSEL(odd, cs, sn);
+		res = VSEL((n & 2) != 0, -res, res);
+	}
+
+	bad = (VINT)VABS(*x) > TRIGMAX;
+	if (vAny(&bad))
+	{
+		for (j = 0; j < VLEN; j++)
+			if (bad[j])
+				res[j] = (which == 0)	? sin((*x)[j])
+						 : (which == 1) ? cos((*x)[j])
+										: tan((*x)[j]);
+	}
+
+	return (res);
+}
+
+/*---------------------------------------------------
+	The kernels, each in place over m doubles.
+---------------------------------------------------*/
+VINLINE void vTrigs(double *x, size_t m, int which)
+{
+	VDBL v;
+	size_t i;
+
+	for (i = 0; i < m; i += VLEN)
+	{
+		v = vLoad(x + i, m - i);
+		v = vTrig(&v, which);
+		vStore(x + i, &v, m - i);
+	}
+}
+
+VKERNEL static void vSin(double *x, size_t m)
+{
+	vTrigs(x, m, 0);
+}
+
+VKERNEL static void vCos(double *x, size_t m)
+{
+	vTrigs(x, m, 1);
+}
+
+VKERNEL static void vTan(double *x, size_t m)
+{
+	vTrigs(x, m, 2);
+}
+
+VKERNEL static void vExp(double *x, size_t m)
+{
+	VDBL v, r, zero = {0};
+	VINT bad;
+	size_t i;
+	int j;
+
+	for (i = 0; i < m; i += VLEN)
+	{
+		v = vLoad(x + i, m - i);
+		r = vExpCore(&v, &zero);
+		bad = (VINT)VABS(v) > EXPMAX;
+		if (vAny(&bad))
+		{
+			for (j = 0; j < VLEN; j++)
+				if (bad[j])
+					r[j] = exp(v[j]);
+		}
+		vStore(x + i, &r, m - i);
+	}
+}
+
+/*---------------------------------------------------
+	vLogs() does ln when base10 is 0 and log10
+	otherwise, as fdlibm does.
+---------------------------------------------------*/
+VINLINE void vLogs(double *x, size_t m, int base10)
+{
+	VDBL v, k, f, r, one = {0};
+	VINT bad;
+	size_t i;
+	int j;
+
+	one = one + 1.0;
+
+	for (i = 0; i < m; i += VLEN)
+	{
+		v = vLoad(x + i, m - i);
+		bad = ~(((VBITS)v - 0x0010000000000000ULL) < 0x7fe0000000000000ULL);
+		r = VSEL(bad, one, v);
+		k = vLogSplit(&r, &f);
+		if (base10)
+			r = k * 3.01029995663611771306e-01 +
+				(k * 3.69423907715893078616e-13 +
+				 4.34294481903251816668e-01 * (f + vLog1pTail(&f)));
+		else
+			r = k * LN2HI + ((f + vLog1pTail(&f)) + k * LN2LO);
+		if (vAny(&bad))
+		{
+			for (j = 0; j < VLEN; j++)
+				if (bad[j])
+					r[j] = base10 ? log10(v[j]) : log(v[j]);
+		}
+		vStore(x + i, &r, m - i);
+	}
+}
+
+VKERNEL static void vLn(double *x, size_t m)
+{
+	vLogs(x, m, 0);
+}
+
+VKERNEL static void vLog10(double *x, size_t m)
+{
+	vLogs(x, m, 1);
+}
+
+/*---------------------------------------------------
+	vPow() puts a^b in a. It is e^(b*ln(a)) with
+	the log and the product in double-double.
+---------------------------------------------------*/
+VKERNEL static void vPow(double *a, const double *b, size_t m)
+{
+	VDBL x, y, lh, ll, th, tl, r, zero = {0};
+	VINT bad;
+	size_t i;
+	int j;
+
+	for (i = 0; i < m; i += VLEN)
+	{
+		x = vLoad(a + i, m - i);
+		y = vLoad(b + i, m - i);
+		bad = ((((VBITS)x - 0x0010000000000000ULL) >= 0x7fe0000000000000ULL) +
+			   ((VINT)VABS(y) >= INFBITS)) < 0;
+		r = VSEL(bad, zero + 1.0, x);
+
+		lh = vLnDD(&r, &ll);
+		TWOPROD(y, lh, th, tl);
+		tl = tl + y * ll;
+		bad = (bad + ((VINT)VABS(th) > EXPMAX)) < 0;
+		th = VSEL(bad, zero, th);
+		tl = VSEL(bad, zero, tl);
+		r = vExpCore(&th, &tl);
+
+		if (vAny(&bad))
+		{
+			for (j = 0; j < VLEN; j++)
+				if (bad[j])
+					r[j] = pow(x[j], y[j]);
+		}
+		vStore(a + i, &r, m - i);
+	}
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+#endif /* VMATH */
+
+/*********************** batch evaluation  *******************************\
+
+	evalBatch( void *tree, const double *t, double *out, size_t n,
+	int *errs ) evaluates the tree for n values of the variable t. The
+	value for t[i] is put in out[i] and, if errs is not NULL, the error
+	code eval() would have set is put in errs[i]. As with eval() the
+	value of an element with an error is zero. The other variables keep
+	the values given to setVariable().
+
+	The tree is compiled and the program run one op at a time over
+	blocks of BATCH elements, so that each op is a plain loop over
+	arrays that the compiler can turn into vector code. The arithmetic
+	is done in double precision. An element keeps the first error it
+	meets in the order eval() would visit the nodes, which is the code
+	eval() would have returned.
+
+	evalBatch() returns 0, 99 if the tree is no good, or -1 if it runs
+	out of memory. evalBatchCompiled() does the same for a program
+	made by compile(). evalBatchCtx() and evalBatchCompiledCtx() take
+	the other variables from a context made by newEvalCtx().
+
+\*-----------------------------------------------------------------------*/
+
+#define BATCH 256
+
+#define SETERR(e, cond, code) ((e) = (e) ? (e) : ((cond) ? (code) : 0))
+
+/*---------------------------------------------------
+	A RANGE is n evenly spaced values from start to
+	stop, for tabulate(), which makes the input of
+	each block as it goes instead of reading it.
+---------------------------------------------------*/
+typedef struct range
+{
+	double start, stop;
+	size_t n;
+	size_t first; /* element 0 of the output is value first */
+} RANGE;
+
+static void rangeFill(const RANGE *r, size_t i, double *x, size_t m)
+{
+	double step;
+	size_t k;
+
+	step = (r->n > 1) ? (r->stop - r->start) / (double)(r->n - 1) : 0.0;
+	for (k = 0, i += r->first; k < m; k++, i++)
+		x[k] = (i + 1 == r->n && r->n > 1) ? r->stop : r->start + (double)i * step;
+}
+
+/*---------------------------------------------------
+	VMAP( kernel, f ) applies f to the m values in
+	b, with the vector kernel when there is one.
+---------------------------------------------------*/
+#if VMATH
+#define VMAP(kernel, f)         \
+	if (VHAVE)                  \
+		kernel(b, m);           \
+	else                        \
+		for (i = 0; i < m; i++) \
+			b[i] = f(b[i])
+#else
+#define VMAP(kernel, f)         \
+	for (i = 0; i < m; i++)     \
+		b[i] = f(b[i])
+#endif
+
+/*---------------------------------------------------
+	batchBlock() runs p over m <= BATCH elements.
+	in[] is bound to the variable with id bind.
+	stack must hold p->depth + p->nslot blocks of
+	BATCH, the slots coming after the stack.
+---------------------------------------------------*/
+static void batchBlock(EVALCTX *c, PROGRAM *p, int bind, const double *in,
+					   double *out, int *e, size_t m, double *stack)
+{
+	INSTR *pc;
+	long double *k;
+	double *sp, *a, *b, *slot, v, tv;
+	long d;
+	size_t i;
+
+	k = PROGCONST(p);
+	sp = stack - BATCH;
+	slot = stack + p->depth * BATCH;
+
+	for (i = 0; i < m; i++)
+		e[i] = 0;
+
+	for (pc = PROGCODE(p); pc->op != OP_END; pc++)
+	{
+		a = sp - BATCH;
+		b = sp;
+
+		switch (pc->op)
+		{
+		case OP_CONST:
+			sp += BATCH;
+			v = (double)k[pc->arg];
+			for (i = 0; i < m; i++)
+				sp[i] = v;
+			break;
+		case OP_VAR:
+			sp += BATCH;
+			if (pc->arg == bind)
+			{
+				memcpy(sp, in, m * sizeof(double));
+			}
+			else
+			{
+				v = (double)c->val[pc->arg];
+				for (i = 0; i < m; i++)
+					sp[i] = v;
+			}
+			break;
+		case OP_AND:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] && b[i]);
+			sp = a;
+			break;
+		case OP_OR:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] || b[i]);
+			sp = a;
+			break;
+		case OP_LE:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] <= b[i]);
+			sp = a;
+			break;
+		case OP_LT:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] < b[i]);
+			sp = a;
+			break;
+		case OP_GE:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] >= b[i]);
+			sp = a;
+			break;
+		case OP_GT:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] > b[i]);
+			sp = a;
+			break;
+		case OP_EQ:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] == b[i]);
+			sp = a;
+			break;
+		case OP_NE:
+			for (i = 0; i < m; i++)
+				a[i] = (a[i] != b[i]);
+			sp = a;
+			break;
+		case OP_ADD:
+			for (i = 0; i < m; i++)
+				a[i] = a[i] + b[i];
+			sp = a;
+			break;
+		case OP_SUB:
+			for (i = 0; i < m; i++)
+				a[i] = a[i] - b[i];
+			sp = a;
+			break;
+		case OP_MUL:
+			for (i = 0; i < m; i++)
+				a[i] = a[i] * b[i];
+			sp = a;
+			break;
+		case OP_MOD:
+			/*----------------------------------------
+				Elements that already have an error
+				may hold anything, so guard every
+				division against a trap.
+			-----------------------------------------*/
+			for (i = 0; i < m; i++)
+			{
+				d = (long)b[i];
+				SETERR(e[i], d == 0, 2);
+				a[i] = (d == 0 || d == -1) ? 0.0 : (double)((long)a[i] % d);
+			}
+			sp = a;
+			break;
+		case OP_DIV:
+			for (i = 0; i < m; i++)
+			{
+				SETERR(e[i], b[i] == 0.0, 2);
+				a[i] = a[i] / (b[i] == 0.0 ? 1.0 : b[i]);
+			}
+			sp = a;
+			break;
+		case OP_POW:
+#if VMATH
+			if (VHAVE)
+			{
+				vPow(a, b, m);
+				sp = a;
+				break;
+			}
+#endif
+			for (i = 0; i < m; i++)
+				a[i] = pow(a[i], b[i]);
+			sp = a;
+			break;
+		case OP_NOT:
+			for (i = 0; i < m; i++)
+				b[i] = !b[i];
+			break;
+		case OP_NEG:
+			for (i = 0; i < m; i++)
+				b[i] = -b[i];
+			break;
+		case OP_SIN:
+			VMAP(vSin, sin);
+			break;
+		case OP_COS:
+			VMAP(vCos, cos);
+			break;
+		case OP_TAN:
+			for (i = 0; i < m; i++)
+				SETERR(e[i], fabs(fmod(b[i], PI) - PI2) < EPSILON, 4);
+			VMAP(vTan, tan);
+			break;
+		case OP_EXP:
+			VMAP(vExp, exp);
+			break;
+		case OP_LOG:
+			for (i = 0; i < m; i++)
+				SETERR(e[i], !(b[i] >= 0.0), 5);
+			VMAP(vLog10, log10);
+			break;
+		case OP_LN:
+			for (i = 0; i < m; i++)
+				SETERR(e[i], !(b[i] >= 0.0), 6);
+			VMAP(vLn, log);
+			break;
+		case OP_SQRT:
+			for (i = 0; i < m; i++)
+			{
+				SETERR(e[i], !(b[i] >= 0.0), 7);
+				b[i] = sqrt(b[i]);
+			}
+			break;
+		case OP_STEP:
+			tv = (double)c->val[0];
+			for (i = 0; i < m; i++)
+				b[i] = (b[i] < (bind == 0 ? in[i] : tv)) ? 1.0 : 0.0;
+			break;
+		case OP_ZERO:
+			for (i = 0; i < m; i++)
+				b[i] = 0.0;
+			break;
+		case OP_SAVE:
+			memcpy(slot + pc->arg * BATCH, b, m * sizeof(double));
+			break;
+		case OP_LOAD:
+			sp += BATCH;
+			memcpy(sp, slot + pc->arg * BATCH, m * sizeof(double));
+			break;
+		default: /* OP_ERR, every element fails here */
+			for (i = 0; i < m; i++)
+				SETERR(e[i], 1, pc->arg);
+			for (i = 0; i < m; i++)
+				out[i] = 0.0;
+			return;
+		}
+	}
+
+	for (i = 0; i < m; i++)
+		out[i] = e[i] ? 0.0 : sp[i];
+}
+
+int evalBatchCompiledCtx(void *ctx, void *prog, const double *t,
+						 double *out, size_t n, int *errs)
+{
+	PROGRAM *p;
+	double *stack;
+	int e[BATCH];
+	size_t base, m;
+
+	p = (PROGRAM *)prog;
+
+	if (p == NULL)
+		return (99);
+	if (FITCTX((EVALCTX *)ctx))
+		return (-1);
+
+	stack = (double *)malloc((p->depth + p->nslot) * BATCH * sizeof(double));
+	if (stack == NULL)
+		return (-1);
+
+	for (base = 0; base < n; base += m)
+	{
+		m = (n - base < BATCH) ? n - base : BATCH;
+		batchBlock((EVALCTX *)ctx, p, 0, t + base, out + base, e, m, stack);
+		if (errs != NULL)
+			memcpy(errs + base, e, m * sizeof(int));
+	}
+
+	free(stack);
+	return (0);
+}
+
+int evalBatchCtx(void *ctx, void *tree, const double *t, double *out,
+				 size_t n, int *errs)
+{
+	void *prog;
+	int err;
+
+	prog = compile(tree, &err);
+	if (prog == NULL)
+		return (err);
+
+	err = evalBatchCompiledCtx(ctx, prog, t, out, n, errs);
+	disposProgram(prog);
+	return (err);
+}
+
+int evalBatchCompiled(void *prog, const double *t, double *out, size_t n,
+					  int *errs)
+{
+	return (evalBatchCompiledCtx(&DefaultCtx, prog, t, out, n, errs));
+}
+
+int evalBatch(void *tree, const double *t, double *out, size_t n, int *errs)
+{
+	return (evalBatchCtx(&DefaultCtx, tree, t, out, n, errs));
+}
+
+/*********************** parallel evaluation  ****************************\
+
+	evalParallel( void *tree, const double *t, double *out, size_t n,
+	int *errs, int nthreads ) does what evalBatch() does, with the
+	work shared between nthreads threads. If nthreads is 0 or less one
+	thread is used per processor. The calling thread is one of them.
+
+	The input is cut into units of PARUNIT elements and each thread is
+	given an equal run of units. A thread takes units from the front of
+	its own run, and once that is empty it steals the back half of the
+	run of another thread, so threads that get slow units or are held
+	up by the system do not leave the others waiting at the end.
+
+	Each thread evaluates with its own copy of the context, so the
+	variables are those set when evalParallel() was called whatever
+	other threads do to them meanwhile. evalParallelCtx() takes them
+	from a context made by newEvalCtx().
+
+	evalParallel() returns what evalBatch() does. Without POSIX threads
+	it is evalBatch().
+
+\*-----------------------------------------------------------------------*/
+
+#define PARALLEL HAVE_POSIX /* the threads are POSIX threads */
+
+#if PARALLEL
+
+#include <pthread.h>
+
+#define PARUNIT (16 * BATCH)
+
+typedef struct worker
+{
+	pthread_mutex_t lock;
+	size_t next, end; /* units still to do, next up to end */
+	struct pool *pool;
+	int id;
+	int status;
+	EVALCTX ctx;
+} WORKER;
+
+typedef struct pool
+{
+	PROGRAM *prog;
+	int bind;		  /* the variable t[] gives */
+	const double *t;  /* or NULL to make it from range */
+	const RANGE *range;
+	double *out;
+	int *errs;
+	size_t n;
+	WORKER *w;
+	int nw;
+} POOL;
+
+/*---------------------------------------------------
+	steal() moves the back half of the run of some
+	other worker to w, returning 0 when all the
+	runs are empty.
+---------------------------------------------------*/
+static int steal(WORKER *w)
+{
+	POOL *pl;
+	WORKER *v;
+	size_t k, lo;
+	int i;
+
+	pl = w->pool;
+
+	for (i = 1; i < pl->nw; i++)
+	{
+		v = &pl->w[(w->id + i) % pl->nw];
+
+		pthread_mutex_lock(&v->lock);
+		k = (v->end - v->next + 1) / 2;
+		lo = v->end -= k;
+		pthread_mutex_unlock(&v->lock);
+
+		if (k > 0)
+		{
+			pthread_mutex_lock(&w->lock);
+			w->next = lo;
+			w->end = lo + k;
+			pthread_mutex_unlock(&w->lock);
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+static void *work(void *arg)
+{
+	WORKER *w;
+	POOL *pl;
+	double *stack, x[BATCH];
+	int e[BATCH], have;
+	size_t u, base, last, m;
+
+	w = (WORKER *)arg;
+	pl = w->pool;
+
+	stack = (double *)malloc((pl->prog->depth + pl->prog->nslot) * BATCH *
+							 sizeof(double));
+	if (stack == NULL)
+	{
+		w->status = -1;
+		return (NULL);
+	}
+
+	for (;;)
+	{
+		pthread_mutex_lock(&w->lock);
+		u = w->next;
+		have = (u < w->end);
+		if (have)
+			w->next++;
+		pthread_mutex_unlock(&w->lock);
+
+		if (!have)
+		{
+			if (steal(w))
+				continue;
+			break;
+		}
+
+		base = u * PARUNIT;
+		last = (pl->n - base < PARUNIT) ? pl->n : base + PARUNIT;
+		for (; base < last; base += m)
+		{
+			m = (last - base < BATCH) ? last - base : BATCH;
+			if (pl->t == NULL)
+				rangeFill(pl->range, base, x, m);
+			batchBlock(&w->ctx, pl->prog, pl->bind,
+					   (pl->t == NULL) ? x : pl->t + base, pl->out + base,
+					   e, m, stack);
+			if (pl->errs != NULL)
+				memcpy(pl->errs + base, e, m * sizeof(int));
+		}
+	}
+
+	free(stack);
+	return (NULL);
+}
+
+/*---------------------------------------------------
+	runPool() runs p over n elements with nthreads
+	threads, the input being t[] bound to variable
+	bind or, if t is NULL, r.
+---------------------------------------------------*/
+static int runPool(EVALCTX *c, PROGRAM *p, int bind, const double *t,
+				   const RANGE *r, double *out, int *errs, size_t n,
+				   int nthreads)
+{
+	POOL pl;
+	WORKER *w;
+	pthread_t *th;
+	long double *val;
+	size_t units;
+	int err, i, *started;
+
+	if (nthreads <= 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	units = (n + PARUNIT - 1) / PARUNIT;
+	if ((size_t)nthreads > units)
+		nthreads = (int)units;
+	if (nthreads < 1)
+		nthreads = 1;
+
+	w = (WORKER *)malloc(nthreads * sizeof(WORKER));
+	th = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+	started = (int *)malloc(nthreads * sizeof(int));
+	val = (long double *)malloc(nthreads * c->nval * sizeof(long double));
+	if (w == NULL || th == NULL || started == NULL || val == NULL)
+	{
+		free(val);
+		free(started);
+		free(th);
+		free(w);
+		return (-1);
+	}
+
+	pl.prog = p;
+	pl.bind = bind;
+	pl.t = t;
+	pl.range = r;
+	pl.out = out;
+	pl.errs = errs;
+	pl.n = n;
+	pl.w = w;
+	pl.nw = nthreads;
+
+	for (i = 0; i < nthreads; i++)
+	{
+		pthread_mutex_init(&w[i].lock, NULL);
+		w[i].next = units * i / nthreads;
+		w[i].end = units * (i + 1) / nthreads;
+		w[i].pool = &pl;
+		w[i].id = i;
+		w[i].status = 0;
+		w[i].ctx = *c;
+		w[i].ctx.val = val + i * c->nval;
+		memcpy(w[i].ctx.val, c->val, c->nval * sizeof(long double));
+	}
+
+	/*---------------------------------------------------
+		A thread that cannot be started leaves its run
+		to be stolen by the others.
+	---------------------------------------------------*/
+	for (i = 1; i < nthreads; i++)
+		started[i] = (pthread_create(&th[i], NULL, work, &w[i]) == 0);
+	work(&w[0]);
+
+	err = w[0].status;
+	for (i = 1; i < nthreads; i++)
+	{
+		if (started[i])
+			pthread_join(th[i], NULL);
+		if (w[i].status)
+			err = w[i].status;
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_mutex_destroy(&w[i].lock);
+	free(val);
+	free(started);
+	free(th);
+	free(w);
+	return (err);
+}
+
+int evalParallelCtx(void *ctx, void *tree, const double *t, double *out,
+					size_t n, int *errs, int nthreads)
+{
+	PROGRAM *p;
+	int err;
+
+	if (nthreads <= 0)
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if ((size_t)nthreads > (n + PARUNIT - 1) / PARUNIT)
+		nthreads = (int)((n + PARUNIT - 1) / PARUNIT);
+	if (nthreads <= 1)
+		return (evalBatchCtx(ctx, tree, t, out, n, errs));
+
+	if (FITCTX((EVALCTX *)ctx))
+		return (-1);
+	if ((p = (PROGRAM *)compile(tree, &err)) == NULL)
+		return (err);
+	err = runPool((EVALCTX *)ctx, p, 0, t, NULL, out, errs, n, nthreads);
+	disposProgram(p);
+	return (err);
+}
+
+#else
+
+/*---- without threads the pool is one loop ----*/
+static int runPool(EVALCTX *c, PROGRAM *p, int bind, const double *t,
+				   const RANGE *r, double *out, int *errs, size_t n,
+				   int nthreads)
+{
+	double *stack, x[BATCH];
+	int e[BATCH];
+	size_t base, m;
+
+	stack = (double *)malloc((p->depth + p->nslot) * BATCH * sizeof(double));
+	if (stack == NULL)
+		return (-1);
+
+	for (base = 0; base < n; base += m)
+	{
+		m = (n - base < BATCH) ? n - base : BATCH;
+		if (t == NULL)
+			rangeFill(r, base, x, m);
+		batchBlock(c, p, bind, (t == NULL) ? x : t + base, out + base, e,
+				   m, stack);
+		if (errs != NULL)
+			memcpy(errs + base, e, m * sizeof(int));
+	}
+
+	free(stack);
+	return (0);
+}
+
+int evalParallelCtx(void *ctx, void *tree, const double *t, double *out,
+					size_t n, int *errs, int nthreads)
+{
+	return (evalBatchCtx(ctx, tree, t, out, n, errs));
+}
+
+#endif /* PARALLEL */
+
+int evalParallel(void *tree, const double *t, double *out, size_t n,
+				 int *errs, int nthreads)
+{
+	return (evalParallelCtx(&DefaultCtx, tree, t, out, n, errs, nthreads));
+}
+
+/*********************** tabulation  ************************************\
+
+	tabulate( void *tree, char *var, double start, double stop,
+	size_t n, double *out ) evaluates the tree for n values of the
+	variable var evenly spaced from start to stop, both included, and
+	puts them in out[], as a graphing program would with a loop over
+	setVariable() and eval(). The values of var are made a block at a
+	time as the work goes, so nothing has to hold them, and the blocks
+	are shared among one thread for each processor as evalParallel()
+	does. An element with an error is zero, as for evalBatch().
+
+	tabulateCtx( void *ctx, void *tree, char *var, double start,
+	double stop, size_t n, double *out, int *errs, int nthreads ) takes
+	the other variables from ctx, puts the error codes in errs[] if it
+	is not NULL and uses nthreads threads, or one for each processor if
+	that is 0 or less.
+
+	Both return what evalBatch() does, or 9 if var is not a variable.
+
+\*-----------------------------------------------------------------------*/
+
+int tabulateCtx(void *ctx, void *tree, char *var, double start, double stop,
+				size_t n, double *out, int *errs, int nthreads)
+{
+	PROGRAM *p;
+	RANGE r;
+	int bind, err;
+
+	if ((bind = getVarID(var)) == VarNotFound)
+		return (9);
+	if (FITCTX((EVALCTX *)ctx))
+		return (-1);
+	if ((p = (PROGRAM *)compile(tree, &err)) == NULL)
+		return (err);
+
+	r.start = start;
+	r.stop = stop;
+	r.n = n;
+	r.first = 0;
+	err = runPool((EVALCTX *)ctx, p, bind, NULL, &r, out, errs, n, nthreads);
+	disposProgram(p);
+	return (err);
+}
+
+int tabulate(void *tree, char *var, double start, double stop, size_t n,
+			 double *out)
+{
+	return (tabulateCtx(&DefaultCtx, tree, var, start, stop, n, out, NULL, 0));
+}
+
+/*********************** interval evaluation  ****************************\
+
+	evalInterval( void *tree, char *var, long double lo, long double hi,
+	long double *ylo, long double *yhi ) bounds the values eval() can
+	return while var goes over every value from lo to hi, the other
+	variables keeping theirs. Each node is worked out for a range of
+	values instead of one, with the sums and products rounded outward
+	and the library functions allowed a few units in the last place of
+	a double, so that every value eval() gives at a point of [lo, hi]
+	without an error is in [*ylo, *yhi]. A NaN value, as sin(inf) gives,
+	is not bounded. The bounds may be wider than the values are, most of
+	all where var occurs more than once, but they are never narrower.
+
+	It returns 0 when no point of [lo, hi] gives an error, so that one
+	call can rule out a divide by zero, the log or square root of a
+	negative number or a pole of tan() over a whole range. Otherwise it
+	returns the code of the first error in the order eval() would meet
+	them that some point may set. When every point sets one *ylo is
+	left greater than *yhi. step() goes from 1 to 0 where its argument
+	reaches t, which is a range itself when var is t.
+
+	evalIntervalCtx( void *ctx, ... ) takes the other variables from
+	ctx. Both return 99 if the tree is no good, -1 if there is no
+	memory, and 9 if var is not a variable.
+
+	Adaptive plotting can skip a piece of the axis whose bounds are
+	inside one pixel, and root finding a piece whose bounds do not
+	hold 0, each after a single pass instead of many calls to eval().
+
+\*-----------------------------------------------------------------------*/
+
+typedef struct ival
+{
+	long double lo, hi; /* the values of the points with no error */
+	int err;			/* the first error some point may set, or 0 */
+	int none;			/* every point sets one */
+	int nan;			/* some point may be a NaN */
+} IVAL;
+
+#define POINT(a) ((a)->lo == (a)->hi && !(a)->nan)
+#define HASZERO(a) ((a)->lo <= 0.0 && (a)->hi >= 0.0)
+#define HASINF(a) ((a)->lo == -HUGE_VALL || (a)->hi == HUGE_VALL)
+#define TRUTH(a) ((a)->lo != 0.0 || (a)->hi != 0.0 || (a)->nan)
+
+/*---- one step outward, for a rounded sum or product ----*/
+static long double ivDown(long double x)
+{
+	return (isfinite(x) ? nextafterl(x, -HUGE_VALL) : x);
+}
+
+static long double ivUp(long double x)
+{
+	return (isfinite(x) ? nextafterl(x, HUGE_VALL) : x);
+}
+
+/*---- outward by more than a double library function is off by ----*/
+static long double libDown(long double x)
+{
+	return (isfinite(x) ? x - fabsl(x) * 4 * DBL_EPSILON - DBL_MIN : x);
+}
+
+static long double libUp(long double x)
+{
+	return (isfinite(x) ? x + fabsl(x) * 4 * DBL_EPSILON + DBL_MIN : x);
+}
+
+/*---------------------------------------------------
+	ivHull() sets r to the smallest range holding
+	the n values of v, leaving out any NaN, then
+	made wider as lib says.
+---------------------------------------------------*/
+static void ivHull(IVAL *r, long double *v, int n, int lib)
+{
+	long double lo = HUGE_VALL, hi = -HUGE_VALL;
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (v[i] != v[i])
+			r->nan = 1;
+		else
+		{
+			if (v[i] < lo)
+				lo = v[i];
+			if (v[i] > hi)
+				hi = v[i];
+		}
+	if (lo > hi)
+	{
+		r->lo = -HUGE_VALL;
+		r->hi = HUGE_VALL;
+		return;
+	}
+	r->lo = lib ? libDown(lo) : ivDown(lo);
+	r->hi = lib ? libUp(hi) : ivUp(hi);
+}
+
+/*---- the range of a test that may be true, t, or false, f ----*/
+static void ivTruth(IVAL *r, int t, int f)
+{
+	r->lo = f ? 0.0 : 1.0;
+	r->hi = t ? 1.0 : 0.0;
+	r->nan = 0;
+}
+
+static void ivFull(IVAL *r)
+{
+	r->lo = -HUGE_VALL;
+	r->hi = HUGE_VALL;
+}
+
+/*---- r is the single value v, which a NaN cannot be ----*/
+static void ivSet(IVAL *r, long double v)
+{
+	r->lo = r->hi = v;
+	if (v != v)
+	{
+		ivFull(r);
+		r->nan = 1;
+	}
+}
+
+/*---- an error some or all of the points set ----*/
+static void ivErr(IVAL *r, int code, int all)
+{
+	if (!r->err)
+		r->err = code;
+	if (all)
+		r->none = 1;
+}
+
+/*---------------------------------------------------
+	ivPoint() does what _eval() does for one node
+	when the operands are single values, so that
+	constant parts are exact. It returns the error.
+	step() is left to ivUnary(), which has t.
+---------------------------------------------------*/
+static int ivPoint(PARSETREE n, long double op1, long double op2,
+				   long double *v)
+{
+	if (n->type == BINOP)
+		switch (n->opratorid)
+		{
+		case 1:
+			*v = (op1 && op2);
+			return (0);
+		case 2:
+			*v = (op1 || op2);
+			return (0);
+		case 3:
+			*v = (op1 <= op2);
+			return (0);
+		case 4:
+			*v = (op1 < op2);
+			return (0);
+		case 5:
+			*v = (op1 >= op2);
+			return (0);
+		case 6:
+			*v = (op1 > op2);
+			return (0);
+		case 7:
+			*v = (op1 == op2);
+			return (0);
+		case 8:
+			*v = (op1 != op2);
+			return (0);
+		case 9:
+			*v = op1 + op2;
+			return (0);
+		case 10:
+			*v = op1 - op2;
+			return (0);
+		case 11:
+			*v = op1 * op2;
+			return (0);
+		case 12:
+			if ((long)op2 == 0)
+				return (2);
+			/*---- LONG_MIN % -1 traps ----*/
+			*v = ((long)op2 == -1) ? 0.0 : (long double)((long)op1 % (long)op2);
+			return (0);
+		case 13:
+			if (op2 == 0.0)
+				return (2);
+			*v = op1 / op2;
+			return (0);
+		case 14:
+			*v = pow(op1, op2);
+			return (0);
+		case 0:
+			return (1);
+		default:
+			return (3);
+		}
+
+	switch (n->opratorid)
+	{
+	case 0:
+		*v = !op1;
+		return (0);
+	case 10:
+		*v = -op1;
+		return (0);
+	case 15:
+		*v = sin(op1);
+		return (0);
+	case 16:
+		*v = cos(op1);
+		return (0);
+	case 17:
+		if (fabs(fmod(op1, PI) - PI2) < EPSILON)
+			return (4);
+		*v = tan(op1);
+		return (0);
+	case 18:
+		*v = exp(op1);
+		return (0);
+	case 19:
+		*v = log10(op1);
+		return ((op1 >= 0.0) ? 0 : 5);
+	case 20:
+		*v = log(op1);
+		return ((op1 >= 0.0) ? 0 : 6);
+	case 21:
+		*v = sqrt(op1);
+		return ((op1 >= 0) ? 0 : 7);
+	case 23:
+	case 24:
+	case 25:
+		*v = 0.0;
+		return (0);
+	default:
+		return (8);
+	}
+}
+
+/*---------------------------------------------------
+	ivTrig() bounds sin() over [a, b], or cos()
+	if cosine is set, from the ends and any peak
+	or trough between them. A peak found a little
+	outside [a, b] only makes the bound wider.
+---------------------------------------------------*/
+static void ivTrig(IVAL *r, double a, double b, int cosine)
+{
+	long double v[4], k, shift;
+	int n = 2;
+
+	if (!isfinite(a) || !isfinite(b) || b - a >= 2 * PI || fabs(a) > 1e6 ||
+		fabs(b) > 1e6)
+	{
+		r->lo = -1.0;
+		r->hi = 1.0;
+		return;
+	}
+	v[0] = cosine ? cos(a) : sin(a);
+	v[1] = cosine ? cos(b) : sin(b);
+	shift = cosine ? 0.0 : PI / 2; /* the first peak at or after 0 */
+	k = ceill((a - shift) / (2 * PI) - 1e-9);
+	if (shift + k * 2 * PI <= b + 1e-9 * (1 + fabs(b)))
+		v[n++] = 1.0;
+	k = ceill((a - shift - PI) / (2 * PI) - 1e-9);
+	if (shift + PI + k * 2 * PI <= b + 1e-9 * (1 + fabs(b)))
+		v[n++] = -1.0;
+	ivHull(r, v, n, 1);
+	if (r->lo < -1.0)
+		r->lo = -1.0;
+	if (r->hi > 1.0)
+		r->hi = 1.0;
+}
+
+/*---------------------------------------------------
+	tan() fails where fmod(x, PI) is within EPSILON
+	of PI2, which happens only for x > 0, and is
+	unbounded at its poles, which are not quite
+	there as PI2 is not quite pi/2.
+---------------------------------------------------*/
+static void ivTan(IVAL *r, double a, double b)
+{
+	long double v[2], k, p;
+
+	if (!isfinite(a) || !isfinite(b) || b - a >= PI || fabs(a) > 1e6 ||
+		fabs(b) > 1e6)
+	{
+		ivErr(r, 4, 0);
+		ivFull(r);
+		return;
+	}
+	k = ceill((a - PI2) / PI - 1e-9);
+	p = PI2 + ((k > 0) ? k : 0) * PI;
+	if (p <= b + 1e-9 * (1 + fabs(b)))
+		ivErr(r, 4, 0);
+	k = ceill((a - PI / 2) / PI - 1e-9);
+	if (PI / 2 + k * PI <= b + 1e-9 * (1 + fabs(b)))
+	{
+		ivFull(r);
+		return;
+	}
+	v[0] = tan(a);
+	v[1] = tan(b);
+	ivHull(r, v, 2, 1);
+}
+
+static void ivPow(IVAL *a, IVAL *b)
+{
+	long double v[4], n;
+	double x0 = (double)a->lo, x1 = (double)a->hi;
+	double y0 = (double)b->lo, y1 = (double)b->hi;
+
+	if (a->lo > 0.0)
+	{
+		/*---- monotonic in each operand, so the ends are at the corners ----*/
+		v[0] = pow(x0, y0);
+		v[1] = pow(x0, y1);
+		v[2] = pow(x1, y0);
+		v[3] = pow(x1, y1);
+		ivHull(a, v, 4, 1);
+		return;
+	}
+	n = b->lo;
+	if (!POINT(b) || n != floorl(n) || fabsl(n) > 1e15)
+	{
+		ivFull(a);
+		a->nan = 1;
+		return;
+	}
+	if (n == 0)
+	{
+		a->lo = a->hi = 1.0;
+		a->nan = 0;
+		return;
+	}
+	if (n < 0 && HASZERO(a))
+	{
+		ivFull(a);
+		return;
+	}
+	v[0] = pow(x0, y0);
+	v[1] = pow(x1, y0);
+	v[2] = (fmodl(n, 2) == 0 && HASZERO(a)) ? 0.0 : v[0];
+	ivHull(a, v, 3, 1);
+}
+
+/*---- a op= b, for the BINOP with opratorid id ----*/
+static void ivBinary(IVAL *a, IVAL *b, int id)
+{
+	long double v[4], m, ma;
+	int nan = a->nan || b->nan;
+
+	switch (id)
+	{
+	case 1:
+		ivTruth(a, TRUTH(a) && TRUTH(b), HASZERO(a) || HASZERO(b));
+		return;
+	case 2:
+		ivTruth(a, TRUTH(a) || TRUTH(b), HASZERO(a) && HASZERO(b));
+		return;
+	case 3:
+		ivTruth(a, a->lo <= b->hi, a->hi > b->lo || nan);
+		return;
+	case 4:
+		ivTruth(a, a->lo < b->hi, a->hi >= b->lo || nan);
+		return;
+	case 5:
+		ivTruth(a, a->hi >= b->lo, a->lo < b->hi || nan);
+		return;
+	case 6:
+		ivTruth(a, a->hi > b->lo, a->lo <= b->hi || nan);
+		return;
+	case 7:
+		ivTruth(a, a->lo <= b->hi && b->lo <= a->hi,
+				!(POINT(a) && POINT(b) && a->lo == b->lo) || nan);
+		return;
+	case 8:
+		ivTruth(a, !(POINT(a) && POINT(b) && a->lo == b->lo) || nan,
+				a->lo <= b->hi && b->lo <= a->hi);
+		return;
+	case 9:
+		nan |= (a->hi == HUGE_VALL && b->lo == -HUGE_VALL) ||
+			   (a->lo == -HUGE_VALL && b->hi == HUGE_VALL);
+		v[0] = a->lo + b->lo;
+		v[1] = a->hi + b->hi;
+		break;
+	case 10:
+		nan |= (a->hi == HUGE_VALL && b->hi == HUGE_VALL) ||
+			   (a->lo == -HUGE_VALL && b->lo == -HUGE_VALL);
+		v[0] = a->lo - b->hi;
+		v[1] = a->hi - b->lo;
+		break;
+	case 11:
+		nan |= (HASZERO(a) && HASINF(b)) || (HASZERO(b) && HASINF(a));
+		v[0] = a->lo * b->lo;
+		v[1] = a->lo * b->hi;
+		v[2] = a->hi * b->lo;
+		v[3] = a->hi * b->hi;
+		a->nan = nan;
+		ivHull(a, v, 4, 0);
+		return;
+	case 12:
+		if ((b->lo < 1.0 && b->hi > -1.0) || b->nan)
+			ivErr(a, 2, b->lo > -1.0 && b->hi < 1.0 && !b->nan);
+		a->nan = 0;
+		if (b->nan || b->lo <= LONG_MIN || b->hi >= LONG_MAX)
+		{
+			ivFull(a);
+			return;
+		}
+		/*---- less than |b| and, when a fits a long, no more than |a| ----*/
+		m = fmaxl(fabsl(truncl(b->lo)), fabsl(truncl(b->hi))) - 1;
+		if (nan || a->lo <= LONG_MIN || a->hi >= LONG_MAX)
+		{
+			a->lo = -m;
+			a->hi = m;
+			return;
+		}
+		ma = truncl(fmaxl(fabsl(a->lo), fabsl(a->hi)));
+		if (ma < m)
+			m = ma;
+		a->hi = (a->hi >= 1.0) ? m : 0.0;
+		a->lo = (a->lo <= -1.0) ? -m : 0.0;
+		return;
+	case 13:
+		if (HASZERO(b))
+			ivErr(a, 2, b->lo == 0.0 && b->hi == 0.0 && !b->nan);
+		if (HASZERO(b))
+		{
+			ivFull(a);
+			a->nan = nan;
+			return;
+		}
+		a->nan = nan || (HASINF(a) && HASINF(b));
+		v[0] = a->lo / b->lo;
+		v[1] = a->lo / b->hi;
+		v[2] = a->hi / b->lo;
+		v[3] = a->hi / b->hi;
+		ivHull(a, v, 4, 0);
+		return;
+	case 14:
+		ivPow(a, b);
+		a->nan |= nan;
+		return;
+	case 0:
+		ivErr(a, 1, 1);
+		return;
+	default:
+		ivErr(a, 3, 1);
+		return;
+	}
+
+	a->nan = nan;
+	ivHull(a, v, 2, 0);
+}
+
+/*---- a = f(a), for the UNOP with opratorid id ----*/
+static void ivUnary(IVAL *a, IVAL *t, int id)
+{
+	long double v[2];
+	double x0 = (double)a->lo, x1 = (double)a->hi;
+
+	switch (id)
+	{
+	case 0:
+		ivTruth(a, HASZERO(a), TRUTH(a));
+		break;
+	case 10:
+		v[0] = -a->hi;
+		a->hi = -a->lo;
+		a->lo = v[0];
+		break;
+	case 15:
+	case 16:
+		a->nan |= HASINF(a);
+		ivTrig(a, x0, x1, id == 16);
+		break;
+	case 17:
+		a->nan |= HASINF(a);
+		ivTan(a, x0, x1);
+		break;
+	case 18:
+		v[0] = exp(x0);
+		v[1] = exp(x1);
+		ivHull(a, v, 2, 1);
+		if (a->lo < 0.0)
+			a->lo = 0.0;
+		break;
+	case 19:
+	case 20:
+	case 21:
+		/*---- a NaN fails the test too ----*/
+		if (a->lo < 0.0 || a->nan)
+			ivErr(a, id - 14, a->hi < 0.0);
+		if (a->hi < 0.0)
+			break;
+		if (x0 < 0.0)
+			x0 = 0.0;
+		v[0] = (id == 19) ? log10(x0) : (id == 20) ? log(x0) : sqrt(x0);
+		v[1] = (id == 19) ? log10(x1) : (id == 20) ? log(x1) : sqrt(x1);
+		a->nan = 0;
+		ivHull(a, v, 2, 1);
+		if (id == 21 && a->lo < 0.0)
+			a->lo = 0.0;
+		break;
+	case 22:
+		ivTruth(a, a->lo < t->hi, a->hi >= t->lo || a->nan);
+		break;
+	case 23:
+	case 24:
+	case 25:
+		a->lo = a->hi = 0.0;
+		a->nan = 0;
+		break;
+	default:
+		ivErr(a, 8, 1);
+		break;
+	}
+}
+
+/*---------------------------------------------------
+	ivEval() works out the range of n in r, walking
+	the left spines as _eval() does. var is the
+	range of the variable bind, t that of t.
+---------------------------------------------------*/
+static void ivEval(EVALCTX *c, PARSETREE n, int bind, IVAL *var, IVAL *t,
+				   IVAL *r)
+{
+	PARSETREE local[SPINE], *s;
+	IVAL b;
+	long double v;
+	int k, len, e;
+
+	switch (n->type)
+	{
+	case BINOP:
+		if ((s = spine(n, local, &len)) == NULL)
+		{
+			r->err = -1;
+			r->none = 1;
+			r->nan = 0;
+			return;
+		}
+		ivEval(c, LEFT(s[len - 1]), bind, var, t, r);
+		for (k = len - 1; k >= 0 && !r->none; k--)
+		{
+			ivEval(c, RIGHT(s[k]), bind, var, t, &b);
+			if (!r->err)
+				r->err = b.err;
+			if (b.none)
+			{
+				r->none = 1;
+				break;
+			}
+			if (POINT(r) && POINT(&b))
+			{
+				if ((e = ivPoint(s[k], r->lo, b.lo, &v)) != 0)
+					ivErr(r, e, 1);
+				ivSet(r, v);
+			}
+			else
+				ivBinary(r, &b, s[k]->opratorid);
+		}
+		if (s != local)
+			free(s);
+		break;
+	case UNOP:
+		ivEval(c, LEFT(n), bind, var, t, r);
+		if (r->none)
+			break;
+		if (POINT(r) && n->opratorid != 22)
+		{
+			if ((e = ivPoint(n, r->lo, 0.0, &v)) != 0)
+				ivErr(r, e, 1);
+			ivSet(r, v);
+		}
+		else
+			ivUnary(r, t, n->opratorid);
+		break;
+	case NUM:
+		r->err = r->none = r->nan = 0;
+		if (n->opratorid == CONST)
+			ivSet(r, numValue(n));
+		else if (n->opratorid == bind)
+			*r = *var;
+		else if (n->opratorid < num_var)
+			ivSet(r, c->val[n->opratorid]);
+		else
+			ivErr(r, 9, 1);
+		break;
+	default:
+		r->err = n->type;
+		r->none = 1;
+		r->nan = 0;
+		break;
+	}
+}
+
+int evalIntervalCtx(void *ctx, void *tree, char *var, long double lo,
+					long double hi, long double *ylo, long double *yhi)
+{
+	EVALCTX *c;
+	PARSETREE n;
+	IVAL x, t, r;
+	int bind;
+
+	c = (EVALCTX *)ctx;
+	n = (tree == NULL) ? NULL : ((TREE *)tree)->root;
+
+	if (n == NULL)
+		return (99);
+	if ((bind = getVarID(var)) == VarNotFound)
+		return (9);
+	if (FITCTX(c))
+		return (-1);
+
+	x.lo = (lo < hi) ? lo : hi;
+	x.hi = (lo < hi) ? hi : lo;
+	x.err = x.none = 0;
+	x.nan = (lo != lo || hi != hi);
+	if (x.nan)
+		ivFull(&x);
+	t = x;
+	if (bind != 0)
+		t.lo = t.hi = c->val[0];
+
+	ivEval(c, n, bind, &x, &t, &r);
+
+	*ylo = r.none ? HUGE_VALL : r.lo;
+	*yhi = r.none ? -HUGE_VALL : r.hi;
+	return (r.err);
+}
+
+int evalInterval(void *tree, char *var, long double lo, long double hi,
+				 long double *ylo, long double *yhi)
+{
+	return (evalIntervalCtx(&DefaultCtx, tree, var, lo, hi, ylo, yhi));
+}
+
+/*********************** differentiation  ********************************\
+
+	differentiate( void *tree, char *var, int *err ) returns a new tree
+	for the derivative of tree with respect to the variable var, made of
+	the same nodes a parsed expression is. It is evaluated, optimized,
+	compiled and disposed of like any tree from parse(), and tree itself
+	is left as it is. *err is set to 0, to 9 if var is not a variable,
+	to 99 if the tree is no good or to -1 if there is no memory, and
+	NULL is returned for the last three.
+
+	The rules are the usual ones, with
+
+		tan(u)'		->	(1+tan(u)^2)*u'
+		log(u)'		->	u'/(u*ln(10))
+		sqrt(u)'	->	u'/(2*sqrt(u))
+		(u^v)'		->	v*u^(v-1)*u'					when v does not
+														depend on var
+		(u^v)'		->	u^v*(v'*ln(u)+v*u'/u)			otherwise
+
+	so that compile() finds the tan(), exp(), sqrt() and u^v of the
+	expression in its derivative as well and works them out once. The
+	comparisons, &&, ||, !, % and step() are constant where they are
+	defined and have a derivative of 0. An operator eval() rejects is
+	copied, so the derivative sets the same error.
+
+	Terms that are 0 are left out as the tree is built, factors of 1
+	dropped and products of numbers worked out, so d/dt of 3*t^2 is
+	6*t. optimize() can be called on the result to do more. Where a
+	term is left out its errors go with it, so the derivative may have
+	a value where the expression sets an error. It is only the slope of
+	the expression where the expression itself has no error.
+
+\*-----------------------------------------------------------------------*/
+
+#define ISNUM(n) ((n)->type == NUM && (n)->opratorid == CONST)
+
+/*---- a copy of n in the arena of c ----*/
+static PARSETREE dCopy(PARSERCTX *c, PARSETREE n)
+{
+	PARSETREE local[SPINE], *s, l;
+	int k, len;
+
+	if (n->type != BINOP)
+	{
+		if ((l = newNode(c)) == NULL)
+			return (NULL);
+		*l = *n;
+		if (n->type == UNOP && (LEFT(l) = dCopy(c, LEFT(n))) == NULL)
+			return (NULL);
+		return (l);
+	}
+
+	if ((s = spine(n, local, &len)) == NULL)
+		return (NULL);
+	l = dCopy(c, LEFT(s[len - 1]));
+	for (k = len - 1; k >= 0 && l != NULL; k--)
+		l = binOpNode(c, s[k]->opratorid, l, dCopy(c, RIGHT(s[k])));
+	if (s != local)
+		free(s);
+	return (l);
+}
+
+static PARSETREE dNeg(PARSERCTX *c, PARSETREE a)
+{
+	if (a == NULL)
+		return (NULL);
+	if (ISNUM(a))
+		return (numNode(c, CONST, -numValue(a)));
+	if (a->type == UNOP && a->opratorid == 10)
+		return (LEFT(a));
+	return (unarOpNode(c, 10, a));
+}
+
+/*---------------------------------------------------
+	dOp() makes the BINOP a id b, leaving out what
+	adds or multiplies by 0 or multiplies by 1 and
+	working out the sums and products of numbers.
+	The number of a product goes on the left.
+---------------------------------------------------*/
+static PARSETREE dOp(PARSERCTX *c, int id, PARSETREE a, PARSETREE b)
+{
+	PARSETREE t;
+	long double x, y;
+
+	if (a == NULL || b == NULL)
+		return (NULL);
+
+	if (id == 11 && ISNUM(b) && !ISNUM(a))
+	{
+		t = a;
+		a = b;
+		b = t;
+	}
+	if (ISNUM(a))
+	{
+		x = numValue(a);
+		if (ISNUM(b))
+		{
+			y = numValue(b);
+			if (id == 9)
+				return (numNode(c, CONST, x + y));
+			if (id == 10)
+				return (numNode(c, CONST, x - y));
+			if (id == 11)
+				return (numNode(c, CONST, x * y));
+			if (id == 13 && y != 0.0)
+				return (numNode(c, CONST, x / y));
+		}
+		if ((id == 9 && x == 0.0) || (id == 11 && x == 1.0))
+			return (b);
+		if ((id == 11 || id == 13) && x == 0.0)
+			return (a);
+		if (id == 10 && x == 0.0)
+			return (dNeg(c, b));
+		if (id == 11 && x == -1.0)
+			return (dNeg(c, b));
+		if (id == 11 && b->type == BINOP && b->opratorid == 11 &&
+			ISNUM(LEFT(b)))
+		{
+			setNum(LEFT(b), x * numValue(LEFT(b)));
+			return (b);
+		}
+	}
+	if (isConst(b, 0.0) && (id == 9 || id == 10))
+		return (a);
+	if (isConst(b, 0.0) && id == 14)
+		return (numNode(c, CONST, 1.0));
+	if (isConst(b, 1.0) && (id == 13 || id == 14))
+		return (a);
+	return (binOpNode(c, id, a, b));
+}
+
+/*---- d times a copy of n, or 0 if d is ----*/
+static PARSETREE dScale(PARSERCTX *c, PARSETREE d, PARSETREE n)
+{
+	if (d == NULL || isConst(d, 0.0))
+		return (d);
+	return (dOp(c, 11, d, dCopy(c, n)));
+}
+
+/*---------------------------------------------------
+	dBinop() is the derivative of the BINOP n given
+	du, that of its left operand.
+---------------------------------------------------*/
+static PARSETREE dBinop(PARSERCTX *c, PARSETREE n, PARSETREE du, int bind)
+{
+	PARSETREE u, v, dv, p;
+
+	u = LEFT(n);
+	v = RIGHT(n);
+
+	if (n->opratorid < 1 || n->opratorid > 14)
+		return (dCopy(c, n));
+	if (n->opratorid <= 8 || n->opratorid == 12)
+		return (numNode(c, CONST, 0.0));
+	if ((dv = dTree(c, v, bind)) == NULL)
+		return (NULL);
+	if (isConst(du, 0.0) && isConst(dv, 0.0))
+		return (du);
+
+	switch (n->opratorid)
+	{
+	case 9:
+	case 10:
+		return (dOp(c, n->opratorid, du, dv));
+	case 11:
+		return (dOp(c, 9, dScale(c, du, v), dScale(c, dv, u)));
+	case 13:
+		if (isConst(dv, 0.0))
+			return (dOp(c, 13, du, dCopy(c, v)));
+		return (dOp(c, 13, dOp(c, 10, dScale(c, du, v), dScale(c, dv, u)),
+					dOp(c, 14, dCopy(c, v), numNode(c, CONST, 2.0))));
+	default:
+		if (isConst(dv, 0.0))
+		{
+			/*---- v*u^(v-1)*u', with v-1 worked out if v is a number ----*/
+			p = dOp(c, 14, dCopy(c, u),
+					dOp(c, 10, dCopy(c, v), numNode(c, CONST, 1.0)));
+			return (dOp(c, 11, dOp(c, 11, dCopy(c, v), p), du));
+		}
+		p = dOp(c, 11, dv, unarOpNode(c, 20, dCopy(c, u)));
+		if (!isConst(du, 0.0))
+			p = dOp(c, 9, p,
+					dOp(c, 13, dScale(c, du, v), dCopy(c, u)));
+		return (dOp(c, 11, dCopy(c, n), p));
+	}
+}
+
+/*---------------------------------------------------
+	dTree() returns the derivative of n, walking the
+	left spines as _eval() does, or NULL if there is
+	no memory.
+---------------------------------------------------*/
+static PARSETREE dTree(PARSERCTX *c, PARSETREE n, int bind)
+{
+	PARSETREE local[SPINE], *s, d, u;
+	int k, len;
+
+	switch (n->type)
+	{
+	case NUM:
+		return (numNode(c, CONST, (n->opratorid == bind) ? 1.0 : 0.0));
+	case BINOP:
+		if ((s = spine(n, local, &len)) == NULL)
+			return (NULL);
+		d = dTree(c, LEFT(s[len - 1]), bind);
+		for (k = len - 1; k >= 0 && d != NULL; k--)
+			d = dBinop(c, s[k], d, bind);
+		if (s != local)
+			free(s);
+		return (d);
+	case UNOP:
+		break;
+	default:
+		return (dCopy(c, n));
+	}
+
+	if (unOpcode(n->opratorid) == OP_ERR)
+		return (dCopy(c, n));
+	if ((d = dTree(c, LEFT(n), bind)) == NULL)
+		return (NULL);
+	if (isConst(d, 0.0))
+		return (d);
+
+	u = LEFT(n);
+	switch (n->opratorid)
+	{
+	case 10:
+		return (dNeg(c, d));
+	case 15:
+		return (dOp(c, 11, unarOpNode(c, 16, dCopy(c, u)), d));
+	case 16:
+		return (dNeg(c, dOp(c, 11, unarOpNode(c, 15, dCopy(c, u)), d)));
+	case 17:
+		return (dOp(c, 11,
+					dOp(c, 9, numNode(c, CONST, 1.0),
+						dOp(c, 14, dCopy(c, n), numNode(c, CONST, 2.0))),
+					d));
+	case 18:
+		return (dOp(c, 11, dCopy(c, n), d));
+	case 19:
+		return (dOp(c, 13, d,
+					dOp(c, 11, dCopy(c, u), numNode(c, CONST, logl(10.0)))));
+	case 20:
+		return (dOp(c, 13, d, dCopy(c, u)));
+	case 21:
+		return (dOp(c, 13, d,
+					dOp(c, 11, numNode(c, CONST, 2.0), dCopy(c, n))));
+	default:
+		return (numNode(c, CONST, 0.0));
+	}
+}
+
+void *differentiate(void *tree, char *var, int *err)
+{
+	PARSERCTX ctx;
+	PARSETREE n;
+	TREE *t;
+	int bind, size = 0, nconst = 0;
+
+	n = (tree == NULL) ? NULL : ((TREE *)tree)->root;
+
+	*err = 0;
+	if (n == NULL)
+	{
+		*err = 99;
+		return (NULL);
+	}
+	if ((bind = getVarID(var)) == VarNotFound)
+	{
+		*err = 9;
+		return (NULL);
+	}
+
+	/*---- most derivatives are a few times the size of the tree ----*/
+	countNodes(n, &size, &nconst);
+	size = (size < TREEBLOCK / 4) ? 4 * size + 1 : TREEBLOCK;
+	if ((t = newBlock(size)) == NULL)
+	{
+		*err = -1;
+		return (NULL);
+	}
+	ctx.tree = ctx.block = t;
+
+	if ((t->root = dTree(&ctx, n, bind)) == NULL)
+	{
+		freeTree(t);
+		*err = -1;
+		return (NULL);
+	}
+	return ((void *)t);
+}
+
+/************************ error( char *s)  *******************************\
+
+\*-----------------------------------------------------------------------*/
+
+static void error(PARSERCTX *c, char *s)
+{
+	char *p;
+
+	if (!c->ParseError)
+	{
+
+		c->ParseError = 1;
+
+		/*---------------------------------------------------
+			Only as much of a long expression as the
+			messages hold is shown, the marker stops at
+			their end.
+		---------------------------------------------------*/
+		strncpy(c->err1Message, c->Start_str, sizeof(c->err1Message) - 1);
+		c->err1Message[sizeof(c->err1Message) - 1] = '\0';
+
+		for (p = c->Start_str + 1; p < c->Str &&
+			 p < c->Start_str + sizeof(c->err2Message) - 64; p++)
+			strcat(c->err2Message, "-");
+
+		strcat(c->err2Message, "^");
+		strcat(c->err2Message, s);
+	}
+}
+
+/*************************** step( long double x)  *************************************\
+
+\*-----------------------------------------------------------------------*/
+
+static long double step(EVALCTX *c, long double x)
+{
+
+	if (x < c->val[0])
+		return (1.0);
+	else
+		return (0.0);
+}
+
+/********************** match( char *token ) ****************************\
+
+	Skips white space and advances Str to 1st non-white char. Then looks
+	for token at the start of Str .
+
+\*-----------------------------------------------------------------------*/
+
+static int match(PARSERCTX *c, char *token)
+
+{
+	register char *p, *t;
+
+	t = token; /* fast local copy of token */
+
+	while (isspace(*c->Str) || (*c->Str == '\n') || (*c->Str == '\t'))
+		c->Str++;
+
+	for (p = c->Str; (*t) && (*t == *p); p++, t++)
+		;
+
+	return ((*t == '\0'));
+}
+
+/*************************** expr()  *************************************\
+
+	expr() reads operands with get_constant() and the binary operators
+	between them, from the lowest precedence to the highest :
+
+		&&  ||
+		<=  <  >=  >  ==  !=
+		+  -
+		*  %  /
+		^
+
+	All of them group left to right, 10-2-3 = (10-2)-3, except ^ which
+	groups right to left, 2^3^2 = 2^(3^2). It works by precedence
+	climbing with a stack of its own instead of a C function for each
+	level, so a long run of operators like the sum of thousands of terms
+	takes no more C stack than a short one. Only parentheses and
+	function calls call expr() again. The stack holds each operator
+	that is still waiting for its right operand together with its left
+	operand.
+
+	Each operator waiting, each parenthesis, function call and unary
+	sign is a level deeper in the tree, which _eval() and the others
+	that walk it recurse through. deeper() stops the parse with an
+	error past MAXNEST levels, before they or the parser itself can
+	run out of C stack.
+
+\*-----------------------------------------------------------------------*/
+
+/*---------------------------------------------------
+	PSTACK is how many operators expr() keeps on the
+	C stack, longer runs of ^ get room from malloc().
+---------------------------------------------------*/
+#define PSTACK 32
+
+typedef struct pending
+{
+	PARSETREE left;
+	int op;
+} PENDING;
+
+static char PREC[] = {0, 1, 1, 2, 2, 2, 2, 2, 2, 3, 3, 4, 4, 4, 5};
+
+/*---------------------------------------------------
+	MAXNEST is how deeply an expression may nest.
+	deeper() takes one more level, or returns 0
+	with the error set if there are no more.
+---------------------------------------------------*/
+#define MAXNEST 1000
+
+static int deeper(PARSERCTX *c)
+{
+	if (c->depth >= MAXNEST)
+	{
+		error(c, " too deeply nested ");
+		return (0);
+	}
+	c->depth++;
+	return (1);
+}
+
+/*---------------------------------------------------
+	binop() returns the id of the binary operator at
+	Str, without taking it, or 0 if there is none.
+---------------------------------------------------*/
+static int binop(PARSERCTX *c)
+{
+	static int order[] = {1, 2, 3, 5, 7, 8, 4, 6, 9, 10, 11, 12, 13, 14};
+	int i;
+
+	for (i = 0; i < (int)(sizeof(order) / sizeof(int)); i++)
+		if (match(c, OPRATOR[order[i]]))
+			return (order[i]);
+	return (0);
+}
+
+static PARSETREE expr(PARSERCTX *c)
+
+{
+	PENDING local[PSTACK], *stack, *more;
+	PARSETREE temp;
+	int op, sp = 0, size = PSTACK;
+
+	stack = local;
+	temp = get_constant(c);
+
+	while (temp != NULL)
+	{
+		op = binop(c);
+
+		/*---------------------------------------------------
+			Everything waiting that binds at least as tight
+			as op, or tighter for ^, takes temp now.
+		---------------------------------------------------*/
+		while (sp > 0 && (op == 0 || PREC[stack[sp - 1].op] > PREC[op] ||
+						  (PREC[stack[sp - 1].op] == PREC[op] && op != 14)))
+		{
+			sp--;
+			c->depth--;
+			temp = binOpNode(c, stack[sp].op, stack[sp].left, temp);
+			if (temp == NULL)
+			{
+				error(c, " Out of memory");
+				break;
+			}
+		}
+
+		if (op == 0 || temp == NULL)
+			break;
+
+		if (!deeper(c))
+		{
+			temp = NULL;
+			break;
+		}
+
+		if (sp == size)
+		{
+			more = (PENDING *)malloc(2 * size * sizeof(PENDING));
+			if (more == NULL)
+			{
+				error(c, " Out of memory");
+				c->depth--;
+				temp = NULL;
+				break;
+			}
+			memcpy(more, stack, size * sizeof(PENDING));
+			if (stack != local)
+				free(stack);
+			stack = more;
+			size *= 2;
+		}
+
+		advance(strlen(OPRATOR[op]));
+		stack[sp].left = temp;
+		stack[sp].op = op;
+		sp++;
+		temp = get_constant(c);
+	}
+
+	c->depth -= sp;
+	if (stack != local)
+		free(stack);
+	return (sp == 0 ? temp : NULL);
+}
+
+/*************************** myAtof()  ***********************************\
+
+	Reads a number, digits with an optional '.' and exponent, or 0x and
+	hex digits with an optional '.' and a binary exponent after 'p' as
+	in C. A '_' may stand between two digits to group them, 1_000_000.
+	The result is correctly rounded. When there are no more significant
+	digits than a long double holds exactly, and the power of ten is
+	exact too, one multiply or divide gives it, otherwise the digits
+	are handed to strtold(). The names inf and nan are read by func().
+
+\*-----------------------------------------------------------------------*/
+
+/*---------------------------------------------------
+	The powers of ten a long double holds exactly,
+	and the most digits it holds exactly. A number
+	needing no more than those is read in one step.
+---------------------------------------------------*/
+#if LDBL_MANT_DIG >= 64
+#define FASTDIG 19
+#define FASTEXP 27
+#else
+#define FASTDIG 15
+#define FASTEXP 22
+#endif
+
+static const long double Pow10[] = {
+	1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+	1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+	1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L};
+
+/*---- the value of digit ch, or -1 ----*/
+static int digitValue(int ch, int hex)
+{
+	if (ch >= '0' && ch <= '9')
+		return (ch - '0');
+	if (hex && ch >= 'a' && ch <= 'f')
+		return (ch - 'a' + 10);
+	if (hex && ch >= 'A' && ch <= 'F')
+		return (ch - 'A' + 10);
+	return (-1);
+}
+
+static long double myAtof(PARSERCTX *c)
+
+{
+	char local[64], *buf, *s, *p;
+	long double val = 0.0;
+	int sign = 1, sn = 1, hex, digits = 0, sig = 0, frac = 0, point = 0;
+	int d, ex = 0;
+
+	while (*c->Str == ' ' || *c->Str == '\n' || *c->Str == '\t')
+		c->Str++;
+
+	for (;;)
+	{
+		if (match(c, "+"))
+		{
+			advance(1);
+		}
+		else if (match(c, "-"))
+		{
+			advance(1);
+			sign *= -1;
+		}
+		else
+			break;
+	}
+
+	while (*c->Str == ' ' || *c->Str == '\n' || *c->Str == '\t')
+		c->Str++;
+
+	hex = c->Str[0] == '0' && (c->Str[1] == 'x' || c->Str[1] == 'X');
+	if (hex)
+		advance(2);
+	s = c->Str;
+
+	for (;; c->Str++)
+	{
+		if ((d = digitValue(*c->Str, hex)) >= 0)
+		{
+			digits++;
+			frac += point;
+			if (sig > 0 || d > 0)
+				sig++;
+			if (sig <= FASTDIG)
+				val = 10.0 * val + d;
+		}
+		else if (*c->Str == '.' && !point)
+			point = 1;
+		else if (*c->Str != '_' || digits == 0 || c->Str[-1] == '.' ||
+				 digitValue(c->Str[1], hex) < 0)
+			break;
+	}
+
+	if (digits == 0)
+	{
+		error(c, " unexpected symbol ");
+		return (0.0);
+	}
+
+	while (*c->Str == ' ' || *c->Str == '\n' || *c->Str == '\t')
+		c->Str++;
+
+	if (hex ? (*c->Str == 'p' || *c->Str == 'P')
+			: (*c->Str == 'e' || *c->Str == 'E'))
+	{
+
+		c->Str++;
+
+		while (*c->Str == ' ' || *c->Str == '\n' || *c->Str == '\t')
+			c->Str++;
+
+		for (;;)
+		{
+			if (match(c, "+"))
+			{
+				advance(1);
+			}
+			else if (match(c, "-"))
+			{
+				advance(1);
+				sn *= -1;
+			}
+			else
+				break;
+		}
+
+		while (*c->Str == ' ' || *c->Str == '\n' || *c->Str == '\t')
+			c->Str++;
+
+		if (*c->Str < '0' || *c->Str > '9')
+			error(c, " unexpected symbol ");
+
+		/*---------------------------------------------------
+			Far past the range of a long double the exponent
+			only has to stay that far, and not overflow.
+		---------------------------------------------------*/
+		for (; (*c->Str >= '0') && (*c->Str <= '9'); c->Str++)
+			if (ex < 100000)
+				ex = 10 * ex + (*c->Str - '0');
+	}
+
+	ex = sn * ex - (hex ? 4 * frac : frac);
+
+	if (!hex && sig <= FASTDIG && ex >= -FASTEXP && ex <= FASTEXP)
+		return (sign * (ex < 0 ? val / Pow10[-ex] : val * Pow10[ex]));
+
+	/*---------------------------------------------------
+		The slow way. The digits go to strtold() without
+		the '.', which depends on the locale, and with
+		the exponent moved to make up for it.
+	---------------------------------------------------*/
+	buf = local;
+	if ((size_t)digits + 16 > sizeof(local) &&
+		(buf = (char *)malloc(digits + 16)) == NULL)
+	{
+		error(c, " Out of memory");
+		return (0.0);
+	}
+
+	p = buf;
+	if (hex)
+	{
+		*p++ = '0';
+		*p++ = 'x';
+	}
+	for (; digits > 0; s++)
+		if (digitValue(*s, hex) >= 0)
+		{
+			*p++ = *s;
+			digits--;
+		}
+	sprintf(p, "%c%d", hex ? 'p' : 'e', ex);
+
+	val = strtold(buf, NULL);
+	if (buf != local)
+		free(buf);
+	return (sign * val);
+}
+
+/*************************** get_constant()  ************************************\
+\*-----------------------------------------------------------------------*/
+static PARSETREE get_constant(PARSERCTX *c)
+
+{
+	PARSETREE temp = NULL;
+
+	if (!match(c, "+") && !match(c, "-") && !match(c, "!"))
+		return (func(c));
+
+	if (!deeper(c))
+		return (NULL);
+
+	if (match(c, "+"))
+	{
+		advance(1);
+		temp = get_constant(c);
+	}
+	else if (match(c, "-"))
+	{
+		advance(1);
+		temp = unarOpNode(c, 10, get_constant(c));
+	}
+	else
+	{
+		advance(1);
+		temp = unarOpNode(c, 0, get_constant(c));
+	}
+
+	c->depth--;
+	return (temp);
+}
+
+/*************************** func()  ************************************\
+
+	A name is read whole, a letter and then letters, digits and '_',
+	and only then looked up, so that the longest name always wins and
+	the order of the tables does not matter. findFunc() recognises the
+	function names by their first and second letters and checks the
+	candidate it lands on, findVar() hashes the variables. The names inf
+	and nan are numbers.
+
+\*-----------------------------------------------------------------------*/
+
+static int findFunc(char *s, int len)
+{
+	int i;
+
+	switch (s[0])
+	{
+	case 'c':
+		i = 16; /* cos */
+		break;
+	case 'e':
+		i = 18; /* exp */
+		break;
+	case 'l':
+		i = (s[1] == 'n') ? 20 : 19; /* ln, log */
+		break;
+	case 's':
+		i = (s[1] == 'i') ? 15 : (s[1] == 'q') ? 21 : 22; /* sin, sqrt, step */
+		break;
+	case 't':
+		i = 17; /* tan */
+		break;
+	default:
+		return (NoOp);
+	}
+
+	if (strncmp(OPRATOR[i], s, len) == 0 && OPRATOR[i][len] == '\0')
+		return (i);
+	else
+		return (NoOp);
+}
+
+/*---- 1 if s is inf or nan, with *v set to its value ----*/
+static int namedNumber(char *s, int len, long double *v)
+{
+	if (len != 3)
+		return (0);
+	if (strncmp(s, "inf", 3) == 0)
+		*v = HUGE_VALL;
+	else if (strncmp(s, "nan", 3) == 0)
+		*v = NAN;
+	else
+		return (0);
+	return (1);
+}
+
+static PARSETREE func(PARSERCTX *c)
+
+{
+	PARSETREE temp = NULL;
+	long double rval = 0.0;
+
+	if (match(c, "("))
+	{
+		/* get expression */
+		advance(1);
+		if (!deeper(c))
+			return (NULL);
+		temp = expr(c);
+		c->depth--;
+
+		if (match(c, ")"))
+		{
+			advance(1);
+		}
+		else
+		{
+			error(c, " Mis-matched parenthesis ");
+			return (NULL);
+		}
+	}
+	else if ((*c->Str >= 'a' && *c->Str <= 'z') ||
+			 (*c->Str >= 'A' && *c->Str <= 'Z'))
+	{
+
+		int i, len;
+
+		/*--------------------------
+			Read the whole name
+		---------------------------*/
+
+		for (len = 1; varChar(c->Str[len]); len++)
+			;
+
+		/*--------------------------
+			Check for a function
+		---------------------------*/
+
+		if ((i = findFunc(c->Str, len)) != NoOp)
+		{
+
+			advance(len);
+
+			if (!match(c, "("))
+			{
+				error(c, " Missing parenthesis ");
+				return (NULL);
+			}
+
+			advance(1);
+			if (!deeper(c))
+				return (NULL);
+
+			temp = unarOpNode(c, i, expr(c));
+			c->depth--;
+
+			if (match(c, ")"))
+				advance(1);
+			else
+			{
+				error(c, " Mis-matched parenthesis ");
+				return (NULL);
+			}
+		}
+		else if (namedNumber(c->Str, len, &rval))
+		{
+			advance(len);
+			temp = numNode(c, CONST, rval);
+		}
+		else
+		{
+			/*----------------------------
+				Check for a variable .
+			-----------------------------*/
+
+			if ((i = findVar(c->Str, len)) != VarNotFound)
+			{
+				advance(len);
+				temp = numNode(c, i, 0.0);
+				if (temp == NULL)
+				{
+					error(c, " Out of memory");
+					return (NULL);
+				}
+			}
+		}
+	}
+	else
+	{ /* or, get number */
+		rval = myAtof(c);
+		temp = numNode(c, CONST, rval);
+	}
+
+	if (temp == NULL)
+	{
+		error(c, " unexpected symbol ");
+		return (NULL);
+	}
+
+	return (temp);
+}
+
+/*************************** parse()  ************************************\
+\*-----------------------------------------------------------------------*/
+
+void *parse(char *expr_p[], int *err, char err_mess[])
+{
+	PARSERCTX ctx, *c = &ctx;
+	PARSETREE rval;
+	TREE *t;
+	size_t len;
+
+	c->Start_str = c->Str = *expr_p;
+
+	/*----------------------------------------------------------
+		Every node of a legal expression is made for at least
+		one character of it, so the length plus one nodes holds
+		the whole tree unless that is more than a block.
+	-----------------------------------------------------------*/
+	len = strlen(*expr_p);
+	t = newBlock(len < TREEBLOCK ? (int)len + 1 : TREEBLOCK);
+	if (t == NULL)
+	{
+		*err = -1;
+		strcpy(err_mess, " Out of memory ");
+		return (NULL);
+	}
+	c->tree = c->block = t;
+
+	/*---------------------------------
+		Skip leading white space.
+		This was added on Jan 28,'89.
+	----------------------------------*/
+	while (*c->Str == ' ' || *c->Str == '\t')
+	{
+		c->Str++;
+	}
+
+	if (!c->Str || !*c->Str)
+	{
+		*err = -1;
+		strcpy(err_mess, *expr_p);
+		strcat(err_mess, "\n Not a Function ");
+		rval = NULL;
+	}
+	else
+	{
+		c->ParseError = 0;
+		c->depth = 0;
+		c->err1Message[0] = '\0';
+		c->err2Message[0] = '\0';
+
+		/*----------------------------------------------------------
+			expr() actually starts the parser
+		-----------------------------------------------------------*/
+		rval = expr(c);
+
+		/*---------------------------------------------------------
+			This code checks for incomplete evaluation of the
+			expression.  The parser can be fooled into evaluating
+			the first part of an expression and then thinking that
+			it is done.  This can only happen with illegal
+			expressions.
+		---------------------------------------------------------*/
+		while (*c->Str != '\0')
+		{
+			if (*c->Str != ' ' && *c->Str != '\n' && *c->Str != '\t')
+			{
+				error(c, " unexpected symbol ");
+				break;
+			}
+			c->Str++;
+		}
+
+		*err = c->ParseError;
+
+		if (c->ParseError)
+		{
+			strcpy(err_mess, c->err1Message);
+			strcat(err_mess, "\n  ");
+			strcat(err_mess, c->err2Message);
+			rval = NULL;
+		}
+		else
+		{
+			err_mess[0] = '\0';
+		}
+
+		/*------------------------------------------------------
+			This line of code incremented our pointer to the
+			end of the parsed string, it is not really a good
+			side effect, so it was removed. Jan 28, '89.
+		*expr_p = c->Str ;
+		--------------------------------------------------------*/
+	}
+
+	if (rval == NULL)
+	{
+		disposParseTree(t);
+		return (NULL);
+	}
+	t->root = rval;
+	return ((void *)t);
+}
+
+/*********************** expression cache  ******************************\
+
+	newExprCache( size_t budget ) returns a cache of parsed expressions,
+	or NULL if there is no memory for it. cacheParse( void *cache,
+	char *expr_p[], int *err, char err_mess[] ) is parse(), except that
+	an expression it has parsed before is not parsed again. The same
+	tree is handed to everyone who asks for that expression, so it must
+	not be changed, optimize() leaves such a tree alone. It is given
+	back with disposParseTree() as usual. Expressions that do not parse
+	are not kept.
+
+	The text is looked up with its white space taken out, except for a
+	single space where two tokens would otherwise run together, so
+	"x * sin( t )" finds "x*sin(t)" but "2 3" stays an error.
+
+	Trees nobody holds stay in the cache until the memory it takes,
+	counted as their blocks and the entries, is more than budget, and
+	then the one given back the longest ago goes first. cacheStats(
+	void *cache, long *hits, long *misses, size_t *bytes ) reports how
+	many lookups found their tree and how many had to parse, and the
+	memory in use. disposExprCache( void *cache ) frees the cache and
+	the trees nobody holds, the others and then the cache are freed as
+	they are given back.
+
+	The cache may be used by several threads at once when there are
+	POSIX threads, it is locked while it is looked in or changed. It
+	must not be disposed of while another thread uses it.
+
+\*-----------------------------------------------------------------------*/
+
+#define JOINS "<>=!&|" /* operator characters that run into one token */
+#define CACHEKEY 256	/* keys up to this long are made on the stack */
+
+typedef struct cacheEntry
+{
+	struct exprCache *cache;
+	struct cacheEntry *chain;		  /* the next in the same bucket */
+	struct cacheEntry *next, *prev; /* the idle list, while refs is 0 */
+	TREE *tree;
+	unsigned long hash;
+	size_t bytes; /* the entry and the tree */
+	int refs;	  /* holders of the tree */
+	int len;
+	char key[1]; /* really len + 1 */
+} CACHEENTRY;
+
+typedef struct exprCache
+{
+	CACHEENTRY **bucket;
+	int nbucket; /* a power of 2 */
+	int n;
+	CACHEENTRY idle; /* idle.next was given back first, idle.prev last */
+	size_t bytes, budget;
+	long hits, misses;
+	int dead; /* disposed of, n trees are still held */
+#if PARALLEL
+	pthread_mutex_t lock;
+#endif
+} EXPRCACHE;
+
+#if PARALLEL
+#define LOCK(c) pthread_mutex_lock(&(c)->lock)
+#define UNLOCK(c) pthread_mutex_unlock(&(c)->lock)
+#else
+#define LOCK(c)
+#define UNLOCK(c)
+#endif
+
+/*---------------------------------------------------
+	1 if a and b, side by side, could be read as one
+	token, a name or number, or an operator like <=.
+	Only a gap between two such is kept in a key.
+---------------------------------------------------*/
+static int joins(int a, int b)
+{
+	if ((varChar(a) || a == '.') && (varChar(b) || b == '.'))
+		return (1);
+	return (strchr(JOINS, a) != NULL && strchr(JOINS, b) != NULL);
+}
+
+/*---- s as a key, returning its length ----*/
+static int normalize(char *s, char *key)
+{
+	int len = 0, gap = 0;
+
+	for (; *s != '\0'; s++)
+	{
+		if (*s == ' ' || *s == '\t' || *s == '\n')
+			gap = 1;
+		else
+		{
+			if (gap && len > 0 && joins(key[len - 1], *s))
+				key[len++] = ' ';
+			key[len++] = *s;
+			gap = 0;
+		}
+	}
+	key[len] = '\0';
+	return (len);
+}
+
+static CACHEENTRY *lookup(EXPRCACHE *c, char *key, int len, unsigned long h)
+{
+	CACHEENTRY *e;
+
+	for (e = c->bucket[h & (c->nbucket - 1)]; e != NULL; e = e->chain)
+		if (e->hash == h && e->len == len && memcmp(e->key, key, len) == 0)
+			break;
+	return (e);
+}
+
+/*---- takes a hold on e, which is then not idle ----*/
+static void hold(CACHEENTRY *e)
+{
+	if (e->refs++ == 0)
+	{
+		e->next->prev = e->prev;
+		e->prev->next = e->next;
+	}
+}
+
+/*---- frees idle entries, the oldest first, until within budget ----*/
+static void evict(EXPRCACHE *c)
+{
+	CACHEENTRY *e, **p;
+
+	while (c->bytes > c->budget && c->idle.next != &c->idle)
+	{
+		e = c->idle.next;
+		e->next->prev = e->prev;
+		e->prev->next = e->next;
+
+		for (p = &c->bucket[e->hash & (c->nbucket - 1)]; *p != e;
+			 p = &(*p)->chain)
+			;
+		*p = e->chain;
+
+		c->n--;
+		c->bytes -= e->bytes;
+		freeTree(e->tree);
+		free(e);
+	}
+}
+
+static void freeCache(EXPRCACHE *c)
+{
+#if PARALLEL
+	pthread_mutex_destroy(&c->lock);
+#endif
+	free(c->bucket);
+	free(c);
+}
+
+static void release(CACHEENTRY *e)
+{
+	EXPRCACHE *c;
+
+	c = e->cache;
+
+	LOCK(c);
+	if (--e->refs == 0 && c->dead)
+	{
+		freeTree(e->tree);
+		free(e);
+		if (--c->n == 0)
+		{
+			UNLOCK(c);
+			freeCache(c);
+			return;
+		}
+	}
+	else if (e->refs == 0)
+	{
+		e->prev = c->idle.prev;
+		e->next = &c->idle;
+		c->idle.prev->next = e;
+		c->idle.prev = e;
+		evict(c);
+	}
+	UNLOCK(c);
+}
+
+/*---- doubles the buckets, if there is memory for it ----*/
+static void regrow(EXPRCACHE *c)
+{
+	CACHEENTRY **bucket, *e, *next;
+	int i, k;
+
+	bucket = (CACHEENTRY **)calloc(2 * c->nbucket, sizeof(CACHEENTRY *));
+	if (bucket == NULL)
+		return;
+
+	for (i = 0; i < c->nbucket; i++)
+		for (e = c->bucket[i]; e != NULL; e = next)
+		{
+			next = e->chain;
+			k = e->hash & (2 * c->nbucket - 1);
+			e->chain = bucket[k];
+			bucket[k] = e;
+		}
+
+	free(c->bucket);
+	c->bucket = bucket;
+	c->nbucket *= 2;
+}
+
+void *newExprCache(size_t budget)
+{
+	EXPRCACHE *c;
+
+	c = (EXPRCACHE *)malloc(sizeof(EXPRCACHE));
+	if (c == NULL)
+		return (NULL);
+
+	c->nbucket = 64;
+	c->bucket = (CACHEENTRY **)calloc(c->nbucket, sizeof(CACHEENTRY *));
+	if (c->bucket == NULL)
+	{
+		free(c);
+		return (NULL);
+	}
+	c->n = 0;
+	c->idle.next = c->idle.prev = &c->idle;
+	c->bytes = 0;
+	c->budget = budget;
+	c->hits = c->misses = 0;
+	c->dead = 0;
+#if PARALLEL
+	pthread_mutex_init(&c->lock, NULL);
+#endif
+	return ((void *)c);
+}
+
+void *cacheParse(void *cache, char *expr_p[], int *err, char err_mess[])
+{
+	EXPRCACHE *c;
+	CACHEENTRY *e, *old;
+	TREE *t, *b;
+	char local[CACHEKEY], *key;
+	unsigned long h;
+	int len;
+
+	c = (EXPRCACHE *)cache;
+
+	key = local;
+	len = strlen(*expr_p);
+	if (len >= CACHEKEY && (key = (char *)malloc(len + 1)) == NULL)
+		return (parse(expr_p, err, err_mess));
+	len = normalize(*expr_p, key);
+	h = hashName(key, len);
+
+	LOCK(c);
+	e = lookup(c, key, len, h);
+	if (e != NULL)
+	{
+		hold(e);
+		c->hits++;
+		UNLOCK(c);
+		if (key != local)
+			free(key);
+		*err = 0;
+		err_mess[0] = '\0';
+		return ((void *)e->tree);
+	}
+	c->misses++;
+	UNLOCK(c);
+
+	/*---------------------------------------------------
+		Parse without the lock, so other lookups are not
+		held up. Another thread may have put the same
+		tree in meanwhile, and then that one is used.
+	---------------------------------------------------*/
+	t = (TREE *)parse(expr_p, err, err_mess);
+	e = NULL;
+	if (t != NULL)
+		e = (CACHEENTRY *)malloc(sizeof(CACHEENTRY) + len);
+	if (e == NULL)
+	{
+		if (key != local)
+			free(key);
+		return ((void *)t);
+	}
+
+	e->cache = c;
+	e->tree = t;
+	e->hash = h;
+	e->refs = 1;
+	e->len = len;
+	memcpy(e->key, key, len + 1);
+	e->bytes = sizeof(CACHEENTRY) + len;
+	for (b = t; b != NULL; b = b->next)
+		e->bytes += TREEHDR + b->size * sizeof(node);
+	if (key != local)
+		free(key);
+
+	LOCK(c);
+	old = lookup(c, e->key, len, h);
+	if (old != NULL)
+	{
+		hold(old);
+		UNLOCK(c);
+		freeTree(t);
+		free(e);
+		return ((void *)old->tree);
+	}
+
+	if (c->n >= c->nbucket)
+		regrow(c);
+	e->chain = c->bucket[h & (c->nbucket - 1)];
+	c->bucket[h & (c->nbucket - 1)] = e;
+	c->n++;
+	c->bytes += e->bytes;
+	t->cached = e;
+	evict(c);
+	UNLOCK(c);
+
+	return ((void *)t);
+}
+
+void cacheStats(void *cache, long *hits, long *misses, size_t *bytes)
+{
+	EXPRCACHE *c;
+
+	c = (EXPRCACHE *)cache;
+	LOCK(c);
+	*hits = c->hits;
+	*misses = c->misses;
+	*bytes = c->bytes;
+	UNLOCK(c);
+}
+
+/*---------------------------------------------------
+	The cache itself has to stay until the last tree
+	held is given back, as release() needs the lock.
+---------------------------------------------------*/
+void disposExprCache(void *cache)
+{
+	EXPRCACHE *c;
+	CACHEENTRY *e, *next;
+	int held;
+
+	c = (EXPRCACHE *)cache;
+	if (c == NULL)
+		return;
+
+	LOCK(c);
+	for (e = c->idle.next; e != &c->idle; e = next)
+	{
+		next = e->next;
+		freeTree(e->tree);
+		free(e);
+		c->n--;
+	}
+	c->dead = 1;
+	held = c->n;
+	UNLOCK(c);
+
+	if (held == 0)
+		freeCache(c);
+}
+
+/*********************** program files  *********************************\
+
+	writeProgram( void *prog, void *buf, size_t size ) stores a compiled
+	program as a record of bytes that can be kept in a file, and returns
+	the number of bytes the record takes. Nothing is written if buf is
+	NULL or size is less than that, so it may be called first to find
+	the size. Records are a multiple of 16 bytes long and a library of
+	programs is just one record after another.
+
+	readProgram( const void *buf, size_t size, size_t *used, int *err )
+	checks the record at buf and returns the program in it, which runs
+	straight from those bytes. Nothing is copied or allocated, so buf
+	must stay as it is while the program is used, and disposProgram()
+	leaves it alone. *used is set to the length of the record, which is
+	where the next one starts. buf must be 16 byte aligned, as memory
+	from malloc() or mmap() is. *err is set to
+
+		0	the program is good
+		1	buf does not hold a program, or one that is damaged
+		2	the program was written on a machine with a different long
+			double or byte order, or by a different version of parseTree
+		3	the variables it uses have other handles here
+
+	and NULL is returned if it is not 0.
+
+	A record keeps the name of every variable up to the last one the
+	program uses. Any of them that are not yet defined are defined by
+	readProgram(), as 0, so defining them all in the same order as the
+	writer did, or not at all, keeps their handles the same. As with
+	defineVariable() libraries should be read before other threads
+	start to parse or evaluate.
+
+	mapPrograms( char *path, size_t *size ) returns the contents of a
+	file, and its size in *size, or NULL if it cannot be read. With
+	POSIX it is mapped read only and shared, so processes that use the
+	same library share its pages and nothing is read that is not run.
+	unmapPrograms( void *buf, size_t size ) gives it back.
+
+\*-----------------------------------------------------------------------*/
+
+#define PROGVERSION 1 /* raised when INSTR, PROGRAM or the op codes change */
+#define PROGCHECK 0x01020304
+
+typedef struct progFile
+{
+	char magic[4]; /* "PTRP" */
+	int version;   /* PROGVERSION */
+	int check;	   /* PROGCHECK, in the byte order of the writer */
+	int ldsize;	   /* sizeof(long double) */
+	int mantdig;   /* LDBL_MANT_DIG */
+	int nopcode;   /* NUMOPCODE */
+	int nvar;	   /* variable names after the program */
+	int size;	   /* bytes in the whole record */
+} PROGFILE;
+
+#define FILEHDR ((sizeof(PROGFILE) + 15) & ~(size_t)15)
+#define ROUND16(n) (((n) + 15) & ~(size_t)15)
+
+/*---- the bytes of the program itself ----*/
+static size_t progSize(PROGRAM *p)
+{
+	return (PROGHDR + p->nconst * sizeof(long double) +
+			p->ncode * sizeof(INSTR));
+}
+
+size_t writeProgram(void *prog, void *buf, size_t size)
+{
+	PROGRAM *p, *q;
+	PROGFILE *f;
+	INSTR *pc;
+	char *s;
+	size_t need, names = 0;
+	int i, nvar = 0;
+
+	p = (PROGRAM *)prog;
+
+	for (pc = PROGCODE(p); pc->op != OP_END; pc++)
+		if (pc->op == OP_VAR && pc->arg >= nvar)
+			nvar = pc->arg + 1;
+	for (i = 0; i < nvar; i++)
+		names += strlen(VARIABLE[i].name) + 1;
+	need = FILEHDR + ROUND16(progSize(p)) + ROUND16(names);
+
+	if (buf == NULL || size < need)
+		return (need);
+
+	memset(buf, 0, need);
+	f = (PROGFILE *)buf;
+	memcpy(f->magic, "PTRP", 4);
+	f->version = PROGVERSION;
+	f->check = PROGCHECK;
+	f->ldsize = sizeof(long double);
+	f->mantdig = LDBL_MANT_DIG;
+	f->nopcode = NUMOPCODE;
+	f->nvar = nvar;
+	f->size = (int)need;
+
+	q = (PROGRAM *)((char *)buf + FILEHDR);
+	memcpy(q, p, progSize(p));
+	q->mapped = 1;
+
+	s = (char *)q + ROUND16(progSize(p));
+	for (i = 0; i < nvar; i++)
+	{
+		strcpy(s, VARIABLE[i].name);
+		s += strlen(s) + 1;
+	}
+	return (need);
+}
+
+/*---------------------------------------------------
+	A program from a file is only run if every op
+	is known, reads only constants, variables and
+	slots that are there, and its depth is the one
+	it really reaches, so a damaged file cannot make
+	evalCompiled() go outside its memory or ask for
+	more of it than the program needs.
+---------------------------------------------------*/
+static int checkProgram(PROGRAM *p, int nvar)
+{
+	INSTR *pc;
+	int i, sp = 0, max = 0;
+
+	if (p->ncode < 1 || p->nconst < 0 || p->depth < 1 || p->nslot < 0 ||
+		p->nslot > p->ncode)
+		return (0);
+
+	for (i = 0, pc = PROGCODE(p); i < p->ncode - 1; i++, pc++)
+	{
+		switch (pc->op)
+		{
+		case OP_CONST:
+			if (pc->arg < 0 || pc->arg >= p->nconst)
+				return (0);
+			sp++;
+			break;
+		case OP_VAR:
+			if (pc->arg < 0 || pc->arg >= nvar)
+				return (0);
+			sp++;
+			break;
+		case OP_LOAD:
+			if (pc->arg < 0 || pc->arg >= p->nslot)
+				return (0);
+			sp++;
+			break;
+		case OP_AND:
+		case OP_OR:
+		case OP_LE:
+		case OP_LT:
+		case OP_GE:
+		case OP_GT:
+		case OP_EQ:
+		case OP_NE:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_MOD:
+		case OP_DIV:
+		case OP_POW:
+			if (--sp < 1)
+				return (0);
+			break;
+		case OP_SAVE:
+			if (pc->arg < 0 || pc->arg >= p->nslot)
+				return (0);
+			/* fall through */
+		default:
+			if (pc->op < 0 || pc->op >= NUMOPCODE || pc->op == OP_END ||
+				sp < 1)
+				return (0);
+			break;
+		}
+		if (sp > max)
+			max = sp;
+	}
+	return (pc->op == OP_END && sp == 1 && max == p->depth);
+}
+
+void *readProgram(const void *buf, size_t size, size_t *used, int *err)
+{
+	PROGFILE *f;
+	PROGRAM *p;
+	char *s, *end;
+	int i, id;
+
+	f = (PROGFILE *)buf;
+	p = (PROGRAM *)((char *)buf + FILEHDR);
+	*used = 0;
+	*err = 1;
+
+	if (((size_t)buf & 15) != 0 || size < FILEHDR + PROGHDR ||
+		memcmp(f->magic, "PTRP", 4) != 0)
+		return (NULL);
+	if (f->version != PROGVERSION || f->check != PROGCHECK ||
+		f->ldsize != sizeof(long double) || f->mantdig != LDBL_MANT_DIG ||
+		f->nopcode != NUMOPCODE)
+	{
+		*err = 2;
+		return (NULL);
+	}
+	if (f->size < 0 || (size_t)f->size > size || (f->size & 15) != 0 ||
+		p->ncode < 1 || p->nconst < 0 || f->nvar < 0 ||
+		(size_t)p->ncode > size / sizeof(INSTR) ||
+		(size_t)p->nconst > size / sizeof(long double) ||
+		FILEHDR + ROUND16(progSize(p)) > (size_t)f->size ||
+		!p->mapped || !checkProgram(p, f->nvar))
+		return (NULL);
+
+	/*---------------------------------------------------
+		Every variable must have the handle it had when
+		the program was written.
+	---------------------------------------------------*/
+	s = (char *)p + ROUND16(progSize(p));
+	end = (char *)buf + f->size;
+	for (i = 0; i < f->nvar; i++)
+	{
+		if (memchr(s, '\0', end - s) == NULL)
+			return (NULL);
+		if ((id = getVarID(s)) == VarNotFound)
+			id = defineVariable(s, 0.0);
+		if (id != i)
+		{
+			*err = 3;
+			return (NULL);
+		}
+		s += strlen(s) + 1;
+	}
+
+	*used = f->size;
+	*err = 0;
+	return ((void *)p);
+}
+
+/*---------------------------------------------------
+	mapFile() and unmapFile() do the work of the two
+	below for any file, which the test program also
+	reads its rows with.
+---------------------------------------------------*/
+static void *mapFile(char *path, size_t *size)
+{
+	void *buf;
+#if HAVE_POSIX
+	struct stat st;
+	int fd;
+
+	*size = 0;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (NULL);
+	buf = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		buf = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (buf == MAP_FAILED)
+			buf = NULL;
+		else
+			*size = st.st_size;
+	}
+	close(fd);
+#else
+	FILE *fp;
+	long n;
+
+	*size = 0;
+	if ((fp = fopen(path, "rb")) == NULL)
+		return (NULL);
+	buf = NULL;
+	if (fseek(fp, 0, SEEK_END) == 0 && (n = ftell(fp)) > 0 &&
+		fseek(fp, 0, SEEK_SET) == 0 && (buf = malloc(n)) != NULL)
+	{
+		if (fread(buf, 1, n, fp) == (size_t)n)
+			*size = n;
+		else
+		{
+			free(buf);
+			buf = NULL;
+		}
+	}
+	fclose(fp);
+#endif
+	return (buf);
+}
+
+static void unmapFile(void *buf, size_t size)
+{
+#if HAVE_POSIX
+	if (buf != NULL)
+		munmap(buf, size);
+#else
+	free(buf);
+#endif
+}
+
+void *mapPrograms(char *path, size_t *size)
+{
+	return (mapFile(path, size));
+}
+
+void unmapPrograms(void *buf, size_t size)
+{
+	unmapFile(buf, size);
+}
+
+/*********************** native code  ***********************************\
+
+	compileNative( void *tree, int *err ) compiles a tree as compile()
+	does and then turns the program into x86-64 machine code, keeping
+	the values of the stack in the SSE registers instead of in memory.
+	Sums, products, compares and square roots are done in line and the
+	other functions are called from the C library. nativeFunction( void
+	*native ) returns the code as a plain C function,
+
+		double f( const double *vars )
+
+	which takes the variable with handle h, see getVarHandle(), from
+	vars[h]. It reads up to the largest handle the expression uses and
+	writes nothing, so any number of threads may call it at once.
+
+	The code works in double rather than long double, so its values
+	may differ from those of eval() in the last few places. Where eval()
+	would set an error it returns a NaN instead. evalNative( void
+	*native, int *err ) takes the variables from the default context
+	and, if the code returns a NaN, runs the program again with the
+	interpreter, so the value is then that of evalCompiled() and *err
+	has the error code eval() sets, 2 for a divide by zero, 7 for the
+	square root of a negative number and so on. evalNativeCtx( void
+	*ctx, void *native, int *err ) takes the variables from ctx.
+
+	On machines without the code generator, or for an expression that
+	needs more registers than there are, nativeFunction() returns NULL
+	and evalNative() always uses the interpreter. *err is set as by
+	compile(). Dispose of it with disposNative().
+
+\*-----------------------------------------------------------------------*/
+
+#if HAVE_POSIX && defined(__x86_64__) && !defined(__CYGWIN__)
+#define JITX86 1
+#else
+#define JITX86 0
+#endif
+
+typedef struct native
+{
+	double (*fn)(const double *); /* the machine code, or NULL */
+	void *code;					  /* the pages it is in */
+	size_t size;
+	void *prog; /* the program, for the interpreter */
+	int nvar;	/* entries of vars[] the code reads */
+} NATIVE;
+
+#if JITX86
+
+/*---------------------------------------------------
+	Stack entry d is kept in register XMM(d), so
+	xmm0 and xmm1 are free for arguments and
+	scratch. The frame has room to keep the stack
+	over a call, then the slots of OP_SAVE.
+
+	The constants follow the code, 1.0, the sign
+	bit and a NaN and then the pool of the program.
+---------------------------------------------------*/
+#define NREG 14
+#define XMM(d) ((d) + 2)
+#define KONE 0
+#define KSIGN 1
+#define KNAN 2
+#define KPOOL 3
+
+#define JR 0 /* the operand is a register */
+#define JK 1 /* a constant */
+#define JM 2 /* memory at a register, rbx or rsp, plus disp */
+#define RBX 3
+#define RSP 4
+
+#define BAIL -1 /* fixup for a jump to the code returning a NaN */
+
+typedef struct jitFix
+{
+	size_t at; /* where the rel32 is */
+	int to;	   /* constant index or BAIL */
+} JITFIX;
+
+typedef struct jit
+{
+	unsigned char *b;
+	size_t n, room;
+	JITFIX *fix;
+	int nfix, fixroom;
+	int bad; /* out of memory */
+} JIT;
+
+/*---- the tan() and % of the interpreter, with a NaN for an error ----*/
+static double nativeTan(double x)
+{
+	if (fabs(fmod(x, PI) - PI2) < EPSILON)
+		return (NAN);
+	return (tan(x));
+}
+
+static double nativeMod(double a, double b)
+{
+	if ((long)b == 0)
+		return (NAN);
+	if ((long)b == -1) /* LONG_MIN % -1 traps */
+		return (0.0);
+	return ((double)((long)a % (long)b));
+}
+
+static void jPut(JIT *j, const void *s, size_t n)
+{
+	unsigned char *b;
+
+	if (j->n + n > j->room)
+	{
+		b = (unsigned char *)realloc(j->b, 2 * j->room + n);
+		if (b == NULL)
+		{
+			j->bad = 1;
+			return;
+		}
+		j->b = b;
+		j->room = 2 * j->room + n;
+	}
+	memcpy(j->b + j->n, s, n);
+	j->n += n;
+}
+
+static void jByte(JIT *j, int x)
+{
+	unsigned char c = (unsigned char)x;
+
+	jPut(j, &c, 1);
+}
+
+static void jLong(JIT *j, int x)
+{
+	jPut(j, &x, 4);
+}
+
+/*---- a rel32 to fill in once the code is laid out ----*/
+static void jFix(JIT *j, int to)
+{
+	JITFIX *f;
+
+	if (j->nfix == j->fixroom)
+	{
+		f = (JITFIX *)realloc(j->fix, (2 * j->fixroom + 16) * sizeof(JITFIX));
+		if (f == NULL)
+		{
+			j->bad = 1;
+			return;
+		}
+		j->fix = f;
+		j->fixroom = 2 * j->fixroom + 16;
+	}
+	j->fix[j->nfix].at = j->n;
+	j->fix[j->nfix++].to = to;
+	jLong(j, 0);
+}
+
+/*---------------------------------------------------
+	jSse() writes the SSE instruction pre 0F op with
+	reg as the register operand and rm as the other,
+	as the mode says.
+---------------------------------------------------*/
+static void jSse(JIT *j, int pre, int op, int reg, int mode, int rm, int disp)
+{
+	int rex = 0x40;
+
+	if (pre)
+		jByte(j, pre);
+	if (reg & 8)
+		rex |= 4;
+	if (mode == JR && (rm & 8))
+		rex |= 1;
+	if (rex != 0x40)
+		jByte(j, rex);
+	jByte(j, 0x0F);
+	jByte(j, op);
+	switch (mode)
+	{
+	case JR:
+		jByte(j, 0xC0 | (reg & 7) << 3 | (rm & 7));
+		break;
+	case JK:
+		jByte(j, (reg & 7) << 3 | 5);
+		jFix(j, rm);
+		break;
+	case JM:
+		jByte(j, 0x80 | (reg & 7) << 3 | rm);
+		if (rm == RSP)
+			jByte(j, 0x24);
+		jLong(j, disp);
+		break;
+	}
+}
+
+/*---- jcc rel32 to the bail out, or jmp with cc 0 ----*/
+static void jBail(JIT *j, int cc)
+{
+	if (cc)
+	{
+		jByte(j, 0x0F);
+		jByte(j, cc);
+	}
+	else
+		jByte(j, 0xE9);
+	jFix(j, BAIL);
+}
+
+/*---- a mask of all ones or zeros in register r made 1.0 or 0.0 ----*/
+static void jOne(JIT *j, int r)
+{
+	jSse(j, 0xF2, 0x10, 1, JK, KONE, 0); /* movsd xmm1, 1.0 */
+	jSse(j, 0x66, 0x54, r, JR, 1, 0);	 /* andpd */
+}
+
+/*---------------------------------------------------
+	jCall() calls fn, a function of nargs doubles,
+	on the top nargs of the top+1 entries of the
+	stack, putting the value in place of the first.
+	Every xmm register is lost over a call, so the
+	entries under the arguments are kept in the
+	frame until it returns.
+---------------------------------------------------*/
+static void jCall(JIT *j, const void *fn, int top, int nargs)
+{
+	int i, live = top + 1 - nargs;
+
+	for (i = 0; i < live; i++)
+		jSse(j, 0xF2, 0x11, XMM(i), JM, RSP, 8 * i);
+	jSse(j, 0x66, 0x28, 0, JR, XMM(live), 0);
+	if (nargs == 2)
+		jSse(j, 0x66, 0x28, 1, JR, XMM(live + 1), 0);
+	jByte(j, 0x48); /* mov rax, fn */
+	jByte(j, 0xB8);
+	jPut(j, fn, sizeof(void (*)(void)));
+	jByte(j, 0xFF); /* call rax */
+	jByte(j, 0xD0);
+	jSse(j, 0x66, 0x28, XMM(live), JR, 0, 0);
+	for (i = 0; i < live; i++)
+		jSse(j, 0xF2, 0x10, XMM(i), JM, RSP, 8 * i);
+}
+
+/*---- add rsp, frame; pop rbx; ret ----*/
+static void jReturn(JIT *j, int frame)
+{
+	jByte(j, 0x48);
+	jByte(j, 0x81);
+	jByte(j, 0xC4);
+	jLong(j, frame);
+	jByte(j, 0x5B);
+	jByte(j, 0xC3);
+}
+
+/*---------------------------------------------------
+	jitProgram() writes the code for p into j and
+	returns the offset of the constants after it,
+	or 0 if there was no memory.
+---------------------------------------------------*/
+static size_t jitProgram(JIT *j, PROGRAM *p)
+{
+	static const double special[KPOOL] = {1.0, -0.0, NAN};
+	double (*f1)(double);
+	double (*f2)(double, double);
+	long double *k;
+	INSTR *pc;
+	size_t data, bail;
+	int frame, sp, a, b, i, rel;
+	double v;
+
+	frame = (8 * (NREG + p->nslot) + 15) & ~15;
+
+	jByte(j, 0x53); /* push rbx */
+	jByte(j, 0x48); /* mov rbx, rdi */
+	jByte(j, 0x89);
+	jByte(j, 0xFB);
+	jByte(j, 0x48); /* sub rsp, frame */
+	jByte(j, 0x81);
+	jByte(j, 0xEC);
+	jLong(j, frame);
+
+	sp = -1;
+	for (pc = PROGCODE(p); pc->op != OP_END; pc++)
+	{
+		a = XMM(sp - 1);
+		b = XMM(sp);
+		switch (pc->op)
+		{
+		case OP_CONST:
+			jSse(j, 0xF2, 0x10, XMM(++sp), JK, KPOOL + pc->arg, 0);
+			break;
+		case OP_VAR:
+			jSse(j, 0xF2, 0x10, XMM(++sp), JM, RBX, 8 * pc->arg);
+			break;
+		case OP_LOAD:
+			jSse(j, 0xF2, 0x10, XMM(++sp), JM, RSP, 8 * (NREG + pc->arg));
+			break;
+		case OP_SAVE:
+			jSse(j, 0xF2, 0x11, b, JM, RSP, 8 * (NREG + pc->arg));
+			break;
+		case OP_ADD:
+			jSse(j, 0xF2, 0x58, a, JR, b, 0);
+			sp--;
+			break;
+		case OP_SUB:
+			jSse(j, 0xF2, 0x5C, a, JR, b, 0);
+			sp--;
+			break;
+		case OP_MUL:
+			jSse(j, 0xF2, 0x59, a, JR, b, 0);
+			sp--;
+			break;
+		case OP_DIV:
+			jSse(j, 0x66, 0x57, 0, JR, 0, 0); /* xorpd xmm0, xmm0 */
+			jSse(j, 0x66, 0x2E, b, JR, 0, 0); /* ucomisd */
+			jBail(j, 0x84);					  /* je, or a NaN */
+			jSse(j, 0xF2, 0x5E, a, JR, b, 0);
+			sp--;
+			break;
+		case OP_LE:
+		case OP_LT:
+		case OP_EQ:
+		case OP_NE:
+			jSse(j, 0xF2, 0xC2, a, JR, b, 0); /* cmpsd */
+			jByte(j, pc->op == OP_LE ? 2 : pc->op == OP_LT ? 1 : pc->op == OP_EQ ? 0 : 4);
+			jOne(j, a);
+			sp--;
+			break;
+		case OP_GE:
+		case OP_GT:
+			jSse(j, 0x66, 0x28, 0, JR, b, 0); /* b <= a, b < a */
+			jSse(j, 0xF2, 0xC2, 0, JR, a, 0);
+			jByte(j, pc->op == OP_GE ? 2 : 1);
+			jOne(j, 0);
+			jSse(j, 0x66, 0x28, a, JR, 0, 0);
+			sp--;
+			break;
+		case OP_AND:
+		case OP_OR:
+			jSse(j, 0x66, 0x57, 0, JR, 0, 0);
+			jSse(j, 0xF2, 0xC2, a, JR, 0, 0); /* cmpneqsd, true for a NaN */
+			jByte(j, 4);
+			jSse(j, 0xF2, 0xC2, b, JR, 0, 0);
+			jByte(j, 4);
+			jSse(j, 0x66, pc->op == OP_AND ? 0x54 : 0x56, a, JR, b, 0);
+			jOne(j, a);
+			sp--;
+			break;
+		case OP_MOD:
+			f2 = nativeMod;
+			jCall(j, &f2, sp, 2);
+			jSse(j, 0x66, 0x2E, a, JR, a, 0);
+			jBail(j, 0x8A); /* jp */
+			sp--;
+			break;
+		case OP_POW:
+			if (pc[-1].op == OP_CONST && PROGCONST(p)[pc[-1].arg] == 2.0)
+			{
+				jSse(j, 0xF2, 0x59, a, JR, a, 0); /* x^2 is x*x */
+				sp--;
+				break;
+			}
+			f2 = pow;
+			jCall(j, &f2, sp, 2);
+			sp--;
+			break;
+		case OP_NOT:
+			jSse(j, 0x66, 0x57, 0, JR, 0, 0);
+			jSse(j, 0xF2, 0xC2, b, JR, 0, 0);
+			jByte(j, 0);
+			jOne(j, b);
+			break;
+		case OP_NEG:
+			jSse(j, 0xF2, 0x10, 0, JK, KSIGN, 0);
+			jSse(j, 0x66, 0x57, b, JR, 0, 0);
+			break;
+		case OP_STEP:
+			jSse(j, 0xF2, 0xC2, b, JM, RBX, 0); /* x < t */
+			jByte(j, 1);
+			jOne(j, b);
+			break;
+		case OP_ZERO:
+			jSse(j, 0x66, 0x57, b, JR, b, 0);
+			break;
+		case OP_SQRT:
+		case OP_LOG:
+		case OP_LN:
+			jSse(j, 0x66, 0x57, 0, JR, 0, 0);
+			jSse(j, 0x66, 0x2E, b, JR, 0, 0);
+			jBail(j, 0x82); /* jb, or a NaN */
+			if (pc->op == OP_SQRT)
 			{
-				evalerr(9);
+				jSse(j, 0xF2, 0x51, b, JR, b, 0);
+				break;
 			}
+			f1 = (pc->op == OP_LOG) ? log10 : log;
+			jCall(j, &f1, sp, 1);
 			break;
-		default:
-			evalerr(n->type);
+		case OP_TAN:
+			f1 = nativeTan;
+			jCall(j, &f1, sp, 1);
+			jSse(j, 0x66, 0x2E, b, JR, b, 0);
+			jBail(j, 0x8A);
+			break;
+		case OP_SIN:
+		case OP_COS:
+		case OP_EXP:
+			f1 = (pc->op == OP_SIN) ? sin : (pc->op == OP_COS) ? cos : exp;
+			jCall(j, &f1, sp, 1);
+			break;
+		default: /* OP_ERR */
+			jBail(j, 0);
 			break;
 		}
 	}
-	return (temp);
+
+	jSse(j, 0x66, 0x28, 0, JR, XMM(0), 0);
+	jReturn(j, frame);
+	bail = j->n;
+	jSse(j, 0xF2, 0x10, 0, JK, KNAN, 0);
+	jReturn(j, frame);
+
+	while (j->n % 16)
+		jByte(j, 0xCC);
+	data = j->n;
+	jPut(j, special, sizeof(special));
+	k = PROGCONST(p);
+	for (i = 0; i < p->nconst; i++)
+	{
+		v = (double)k[i];
+		jPut(j, &v, sizeof(v));
+	}
+	if (j->bad)
+		return (0);
+
+	for (i = 0; i < j->nfix; i++)
+	{
+		rel = (int)((j->fix[i].to == BAIL ? bail : data + 8 * j->fix[i].to) -
+					(j->fix[i].at + 4));
+		memcpy(j->b + j->fix[i].at, &rel, 4);
+	}
+	return (data);
 }
 
-/************************ error( char *s)  *******************************\
+/*---------------------------------------------------
+	The code is written into pages that can be
+	written and then made executable but no longer
+	writable.
+---------------------------------------------------*/
+static void jitNative(NATIVE *x)
+{
+	JIT j;
+	void *mem;
+	size_t size, page;
 
-\*-----------------------------------------------------------------------*/
+	memset(&j, 0, sizeof(j));
+	if (jitProgram(&j, (PROGRAM *)x->prog) != 0)
+	{
+		page = (size_t)sysconf(_SC_PAGESIZE);
+		size = (j.n + page - 1) / page * page;
+		mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mem != MAP_FAILED)
+		{
+			memcpy(mem, j.b, j.n);
+			if (mprotect(mem, size, PROT_READ | PROT_EXEC) == 0)
+			{
+				x->code = mem;
+				x->size = size;
+				x->fn = (double (*)(const double *))mem;
+			}
+			else
+				munmap(mem, size);
+		}
+	}
+	free(j.fix);
+	free(j.b);
+}
+
+#endif /* JITX86 */
 
-static void error(char *s)
+void *compileNative(void *tree, int *err)
 {
-	char *p;
+	NATIVE *x;
+	PROGRAM *p;
+	INSTR *pc;
 
-	if (!ParseError)
+	if ((p = (PROGRAM *)compile(tree, err)) == NULL)
+		return (NULL);
+	if ((x = (NATIVE *)malloc(sizeof(NATIVE))) == NULL)
 	{
+		disposProgram(p);
+		*err = -1;
+		return (NULL);
+	}
+	x->fn = NULL;
+	x->code = NULL;
+	x->size = 0;
+	x->prog = p;
+	x->nvar = 1;
+	for (pc = PROGCODE(p); pc->op != OP_END; pc++)
+		if (pc->op == OP_VAR && pc->arg >= x->nvar)
+			x->nvar = pc->arg + 1;
+
+#if JITX86
+	if (p->depth <= NREG)
+		jitNative(x);
+#endif
+	return ((void *)x);
+}
+
+double (*nativeFunction(void *native))(const double *)
+{
+	return ((native == NULL) ? NULL : ((NATIVE *)native)->fn);
+}
 
-		ParseError = 1;
+long double evalNativeCtx(void *ctx, void *native, int *err_num)
+{
+	EVALCTX *c;
+	NATIVE *x;
+	double local[VMSTACK], *vars, v;
+	int i;
 
-		strcpy(err1Message, Start_str);
+	c = (EVALCTX *)ctx;
+	x = (NATIVE *)native;
 
-		for (p = Start_str + 1; p < Str; p++)
-			strcat(err2Message, "-");
+	if (x == NULL)
+	{
+		*err_num = 99;
+		return (0);
+	}
+	if (x->fn == NULL)
+		return (evalCompiledCtx(c, x->prog, err_num));
+	if (FITCTX(c))
+	{
+		*err_num = -1;
+		return (0);
+	}
 
-		strcat(err2Message, "^");
-		strcat(err2Message, s);
+	vars = local;
+	if (x->nvar > VMSTACK &&
+		(vars = (double *)malloc(x->nvar * sizeof(double))) == NULL)
+	{
+		*err_num = -1;
+		return (0);
 	}
+	for (i = 0; i < x->nvar; i++)
+		vars[i] = (double)c->val[i];
+	v = x->fn(vars);
+	if (vars != local)
+		free(vars);
+
+	if (v != v) /* an error, or just a NaN */
+		return (evalCompiledCtx(c, x->prog, err_num));
+	*err_num = 0;
+	return (v);
 }
 
-/*************************** step( long double x)  *************************************\
+long double evalNative(void *native, int *err_num)
+{
+	return (evalNativeCtx(&DefaultCtx, native, err_num));
+}
+
+void disposNative(void *native)
+{
+	NATIVE *x = (NATIVE *)native;
+
+	if (x == NULL)
+		return;
+#if JITX86
+	if (x->code != NULL)
+		munmap(x->code, x->size);
+#endif
+	disposProgram(x->prog);
+	free(x);
+}
+
+/*********************** C source  **************************************\
+
+	emitC( void *tree, char *name, int prec, char *buf, size_t size )
+	writes a C function that works out the expression,
+
+		T name( const T *v, int *err )
+
+	where T is the type evalPrec() works in for prec, see PREC_DEFAULT
+	and the others. The function takes the variable with handle h, see
+	getVarHandle(), from v[h], and sets *err and returns the value that
+	evalPrec() would, with the same checks and error codes. The source
+	needs only <math.h>, so a file of such functions can be built ahead
+	of time with the best optimization the compiler has and loaded with
+	dlopen(). A compiler that works out a library function of a
+	constant itself may get a last bit other than the library does.
+
+	emitC() returns the number of bytes the source takes, counting the
+	'\0' at the end, or 0 if the tree is no good or there is no memory.
+	Nothing is written if buf is NULL or size is less than that, so it
+	may be called first to find the size.
+
+	The function is written from the program compile() makes, one
+	statement an instruction, with a local variable for each entry of
+	the stack and for each saved subexpression.
 
 \*-----------------------------------------------------------------------*/
 
-static long double step(long double x)
+typedef struct emitBuf
 {
+	char *buf; /* NULL to only count */
+	size_t n;
+} EMITBUF;
 
-	if (x < VARIABLE[0].val)
-		return (1.0);
+static void emitf(EMITBUF *e, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	if (e->buf == NULL)
+		len = vsnprintf(NULL, 0, fmt, ap);
 	else
-		return (0.0);
+		len = vsprintf(e->buf + e->n, fmt, ap);
+	va_end(ap);
+	if (len > 0)
+		e->n += len;
 }
 
-/********************** match( char *token ) ****************************\
+/*---- a long double as a C constant that keeps every bit of it ----*/
+static void emitNum(EMITBUF *e, long double v)
+{
+	if (v != v)
+		emitf(e, "NAN");
+	else if (v == HUGE_VALL || v == -HUGE_VALL)
+		emitf(e, "%sHUGE_VALL", (v < 0) ? "-" : "");
+	else
+		emitf(e, "%LaL", v);
+}
 
-	Skips white space and advances Str to 1st non-white char. Then looks
-	for token at the start of Str .
+static void emitProgram(EMITBUF *e, PROGRAM *p, char *name, int prec)
+{
+	static char *type[] = {"long double", "float", "double", "long double"};
+	static char *suffix[] = {"", "f", "", "l"};
+	static char *cast[] = {"", "(float)", "", "(long double)"};
+	char *t, *m, *fn;
+	INSTR *pc;
+	int i, sp, a, b, fail = 0;
+
+	if (prec < PREC_DEFAULT || prec > PREC_LONG)
+		prec = PREC_DEFAULT;
+	t = type[prec];
+	m = suffix[prec];
+
+	emitf(e, "%s %s(const %s *v, int *err)\n{\n", t, name, t);
+	for (i = 0; i < p->depth; i++)
+		emitf(e, "\t%s r%d;\n", t, i);
+	for (i = 0; i < p->nslot; i++)
+		emitf(e, "\t%s s%d;\n", t, i);
+	emitf(e, "\n");
+
+	sp = -1;
+	for (pc = PROGCODE(p); pc->op != OP_END; pc++)
+	{
+		a = sp - 1;
+		b = sp;
+		fn = NULL;
+		switch (pc->op)
+		{
+		case OP_CONST:
+			emitf(e, "\tr%d = ", ++sp);
+			emitNum(e, PROGCONST(p)[pc->arg]);
+			emitf(e, ";\n");
+			break;
+		case OP_VAR:
+			emitf(e, "\tr%d = v[%d];\n", ++sp, pc->arg);
+			break;
+		case OP_LOAD:
+			emitf(e, "\tr%d = s%d;\n", ++sp, pc->arg);
+			break;
+		case OP_SAVE:
+			emitf(e, "\ts%d = r%d;\n", pc->arg, b);
+			break;
+		case OP_AND:
+		case OP_OR:
+		case OP_LE:
+		case OP_LT:
+		case OP_GE:
+		case OP_GT:
+		case OP_EQ:
+		case OP_NE:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+			emitf(e, "\tr%d = r%d %s r%d;\n", a, a,
+				  OPRATOR[pc->op - OP_AND + 1], b);
+			sp--;
+			break;
+		case OP_MOD:
+			emitf(e, "\tif ((long)r%d == 0)\n\t\tgoto fail2;\n", b);
+			fail |= 1 << 2;
+			emitf(e,
+				  "\tr%d = ((long)r%d == -1) ? 0\n"
+				  "\t\t: (%s)((long)r%d %% (long)r%d);\n",
+				  a, b, t, a, b);
+			sp--;
+			break;
+		case OP_DIV:
+			emitf(e, "\tif (r%d == 0.0)\n\t\tgoto fail2;\n", b);
+			fail |= 1 << 2;
+			emitf(e, "\tr%d = r%d / r%d;\n", a, a, b);
+			sp--;
+			break;
+		case OP_POW:
+			emitf(e, "\tr%d = pow%s(r%d, r%d);\n", a, m, a, b);
+			sp--;
+			break;
+		case OP_NOT:
+			emitf(e, "\tr%d = !r%d;\n", b, b);
+			break;
+		case OP_NEG:
+			emitf(e, "\tr%d = -r%d;\n", b, b);
+			break;
+		case OP_TAN:
+			/*---- the constants of the type, as M(PI) in _eval() ----*/
+			emitf(e, "\tif (fabs%s(fmod%s(r%d, %s%s) - %s%s) < ", m, m, b,
+				  cast[prec], "3.14159265358979323846", cast[prec],
+				  "1.5707963268");
+			emitNum(e, EPSILON);
+			emitf(e, ")\n\t\tgoto fail4;\n");
+			fail |= 1 << 4;
+			fn = "tan";
+			break;
+		case OP_LOG:
+			emitf(e, "\tif (!(r%d >= 0.0))\n\t\tgoto fail5;\n", b);
+			fail |= 1 << 5;
+			fn = "log10";
+			break;
+		case OP_LN:
+			emitf(e, "\tif (!(r%d >= 0.0))\n\t\tgoto fail6;\n", b);
+			fail |= 1 << 6;
+			fn = "log";
+			break;
+		case OP_SQRT:
+			emitf(e, "\tif (!(r%d >= 0.0))\n\t\tgoto fail7;\n", b);
+			fail |= 1 << 7;
+			fn = "sqrt";
+			break;
+		case OP_SIN:
+			fn = "sin";
+			break;
+		case OP_COS:
+			fn = "cos";
+			break;
+		case OP_EXP:
+			fn = "exp";
+			break;
+		case OP_STEP:
+			emitf(e, "\tr%d = r%d < v[0];\n", b, b);
+			break;
+		case OP_ZERO:
+			emitf(e, "\tr%d = 0;\n", b);
+			break;
+		default: /* OP_ERR */
+			emitf(e, "\t*err = %d;\n\treturn (0);\n", pc->arg);
+			break;
+		}
+		if (fn != NULL)
+			emitf(e, "\tr%d = %s%s(r%d);\n", b, fn, m, b);
+	}
+
+	emitf(e, "\n\t*err = 0;\n\treturn (r0);\n");
+	for (i = 2; i <= 7; i++)
+		if (fail & (1 << i))
+			emitf(e, "fail%d:\n\t*err = %d;\n\treturn (0);\n", i, i);
+	emitf(e, "}\n");
+}
+
+size_t emitC(void *tree, char *name, int prec, char *buf, size_t size)
+{
+	PROGRAM *p;
+	EMITBUF e;
+	int err;
+
+	if ((p = (PROGRAM *)compile(tree, &err)) == NULL)
+		return (0);
+
+	e.buf = NULL;
+	e.n = 0;
+	emitProgram(&e, p, name, prec);
+	if (buf != NULL && size > e.n)
+	{
+		e.buf = buf;
+		e.n = 0;
+		emitProgram(&e, p, name, prec);
+	}
+	disposProgram(p);
+	return (e.n + 1);
+}
+
+/*************************** benchmark  **********************************\
+
+	The benchmark program, made with BENCH as 1, times in turn
+
+		eval() against evalCompiled(), deep and repeating expressions
+		setVariable() and eval() in a loop against evalBatch()
+		eval() before and after optimize()
+		evalParallel(), one thread up to one per processor
+		parse() with disposParseTree(), up to a sum of 100k terms
+		the memory the trees of many small formulas take at once
+		setting a dozen inputs by name against by handle
+		parse() before and after hundreds of variables are defined
+		evalPrec() in each precision
+		parse() against cacheParse() of the same expression
+		parse() with compile() against readProgram(), a library
+		eval() against evalIncremental(), a few variables changed
+		eval() against evalMultiBatch(), hundreds of channels
+		compileNative() against evalCompiled() and the same in C
+		emitC() built with the C compiler, checked against eval()
+		tabulate() against the loop a graphing program writes
+		evalInterval() against eval() on pieces, looking for roots
+		the derivative from differentiate() against a difference
+
+	Run with the argument suite, the benchmark program instead times
+	a fixed corpus of short, deep, function heavy and variable heavy
+	expressions. It gives parse() in ns a character, eval() and
+	evalCompiled() in ns a node and evalBatch() in ns an element, as
+	percentiles over many samples, one JSON object a line.
 
 \*-----------------------------------------------------------------------*/
 
-static int match(char *token)
+#if BENCH
 
+#include <time.h>
+
+static double nowNs(void)
 {
-	register char *p, *t;
+	struct timespec ts;
 
-	t = token; /* fast local copy of token */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
 
-	while (isspace(*Str) || (*Str == '\n') || (*Str == '\t'))
-		Str++;
+/*---------------------------------------------------
+	nested() writes depth levels of a polynomial in
+	Horner form, ((t*0.5+1)*0.5+2)*0.5+3 ...
+	chain() writes a flat sum of terms.
+---------------------------------------------------*/
+static char *nested(int depth)
+{
+	char *s, *p;
+	int i;
+
+	s = (char *)malloc(depth * 24 + 8);
+	p = s;
+	for (i = 0; i < depth; i++)
+		*p++ = '(';
+	p += sprintf(p, "t");
+	for (i = 0; i < depth; i++)
+		p += sprintf(p, "*0.5+%d)", i + 1);
+	return (s);
+}
 
-	for (p = Str; (*t) && (*t == *p); p++, t++)
-		;
+static char *chain(int terms)
+{
+	char *s, *p;
+	int i;
+
+	s = (char *)malloc(terms * 32 + 8);
+	p = s;
+	p += sprintf(p, "sin(t)");
+	for (i = 1; i < terms; i++)
+		p += sprintf(p, "+%d.5*t*cos(t/%d)", i, i);
+	return (s);
+}
 
-	return ((*t == '\0'));
+/*---- a sum of terms with full precision coefficients ----*/
+static char *coefficients(int terms)
+{
+	char *s, *p;
+	int i;
+
+	s = (char *)malloc(terms * 40 + 8);
+	p = s;
+	p += sprintf(p, "0");
+	for (i = 0; i < terms; i++)
+		p += sprintf(p, "+%.16e*t^%d", sin(i + 1.0) * pow(10.0, i % 9 - 4), i);
+	return (s);
 }
 
-/*************************** expr()  *************************************\
+static void benchCompiled(char *name, char *expr, long reps)
+{
+	void *tree, *prog;
+	char *p, mess[1024];
+	int err, e1, e2;
+	long i;
+	double t0, t1, t2;
+	long double v1 = 0.0, v2 = 0.0;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	if (err)
+	{
+		printf("%-10s parse error %d\n", name, err);
+		return;
+	}
+	prog = compile(tree, &err);
 
-\*-----------------------------------------------------------------------*/
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariable("t", (long double)i * 1e-3);
+		v1 += eval(tree, &e1);
+	}
+	t1 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariable("t", (long double)i * 1e-3);
+		v2 += evalCompiled(prog, &e2);
+	}
+	t2 = nowNs();
+
+	printf("%-10s eval %9.1f ns  compiled %9.1f ns  speedup %5.2fx  %s\n",
+		   name, (t1 - t0) / reps, (t2 - t1) / reps, (t1 - t0) / (t2 - t1),
+		   (v1 == v2 && e1 == e2) ? "ok" : "MISMATCH");
+
+	disposProgram(prog);
+	disposParseTree(tree);
+}
+
+static void benchBatch(char *name, char *expr, long n)
+{
+	void *tree;
+	char *p, mess[1024];
+	double *t, *out, t0, t1, t2;
+	int err, *errs;
+	long i;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	t = (double *)malloc(n * sizeof(double));
+	out = (double *)malloc(n * sizeof(double));
+	errs = (int *)malloc(n * sizeof(int));
+	for (i = 0; i < n; i++)
+		t[i] = i * 1e-5;
+
+	t0 = nowNs();
+	for (i = 0; i < n; i++)
+	{
+		setVariable("t", t[i]);
+		out[i] = eval(tree, &errs[i]);
+	}
+	t1 = nowNs();
+	evalBatch(tree, t, out, n, errs);
+	t2 = nowNs();
+
+	printf("%-10s eval %9.1f ns  batch    %9.1f ns  speedup %5.2fx\n",
+		   name, (t1 - t0) / n, (t2 - t1) / n, (t1 - t0) / (t2 - t1));
 
-static PARSETREE expr(void)
+	free(errs);
+	free(out);
+	free(t);
+	disposParseTree(tree);
+}
 
+static void benchOptimize(char *name, char *expr, long reps)
 {
-	PARSETREE left, temp = NULL, term();
+	void *tree, *opt;
+	char *p, mess[1024];
+	int err, e1, e2, removed;
+	long i;
+	double t0, t1, t2;
+	long double v1 = 0.0, v2 = 0.0;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	p = expr;
+	opt = optimize(parse(&p, &err, mess), &removed);
+
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariable("t", (long double)i * 1e-3);
+		v1 += eval(tree, &e1);
+	}
+	t1 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariable("t", (long double)i * 1e-3);
+		v2 += eval(opt, &e2);
+	}
+	t2 = nowNs();
+
+	printf("%-10s eval %9.1f ns  optimized %6.1f ns  speedup %5.2fx  "
+		   "%d nodes removed\n",
+		   name, (t1 - t0) / reps, (t2 - t1) / reps, (t1 - t0) / (t2 - t1),
+		   removed);
 
-	temp = left = term();
+	disposParseTree(opt);
+	disposParseTree(tree);
+}
 
-	if (match("&&"))
+static void benchParallel(char *name, char *expr, long n)
+{
+	void *tree;
+	char *p, mess[1024];
+	double *t, *out, t0, t1, base = 0.0;
+	int err, nt, ncpu;
+	long i;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	t = (double *)malloc(n * sizeof(double));
+	out = (double *)malloc(n * sizeof(double));
+	for (i = 0; i < n; i++)
+		t[i] = i * 1e-7;
+
+#if PARALLEL
+	ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	ncpu = 1;
+#endif
+
+	for (nt = 1;; nt = (nt * 2 < ncpu) ? nt * 2 : ncpu)
 	{
-		advance(2);
-		temp = binOpNode(1, left, expr());
+		t0 = nowNs();
+		evalParallel(tree, t, out, n, NULL, nt);
+		t1 = nowNs();
+		if (nt == 1)
+			base = t1 - t0;
+		printf("%-10s %3d threads %7.2f ns  speedup %5.2fx\n",
+			   name, nt, (t1 - t0) / n, base / (t1 - t0));
+		if (nt == ncpu)
+			break;
 	}
-	else if (match("||"))
+
+	free(out);
+	free(t);
+	disposParseTree(tree);
+}
+
+static void benchParse(char *name, char *expr, long reps)
+{
+	void *tree;
+	char *p, mess[1024];
+	double t0, t1;
+	int err;
+	long i;
+
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
 	{
-		advance(2);
-		temp = binOpNode(2, left, expr());
+		p = expr;
+		tree = parse(&p, &err, mess);
+		disposParseTree(tree);
 	}
+	t1 = nowNs();
 
-	return (temp);
+	printf("%-10s parse+dispose %9.1f ns\n", name, (t1 - t0) / reps);
 }
 
-/*************************** term()  *************************************\
-\*-----------------------------------------------------------------------*/
+static void benchCache(char *name, char *expr, long reps)
+{
+	void *cache, *tree;
+	char *p, mess[1024];
+	double t0, t1;
+	int err;
+	long i, hits, misses;
+	size_t bytes;
+
+	cache = newExprCache(1 << 20);
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		p = expr;
+		tree = cacheParse(cache, &p, &err, mess);
+		disposParseTree(tree);
+	}
+	t1 = nowNs();
+	cacheStats(cache, &hits, &misses, &bytes);
+	disposExprCache(cache);
 
-static PARSETREE term(void)
+	printf("%-10s cacheParse+dispose %9.1f ns  hits %ld misses %ld  %lu bytes\n",
+		   name, (t1 - t0) / reps, hits, misses, (unsigned long)bytes);
+}
 
+/*---- n formulas parsed and compiled, against read from a library ----*/
+static void benchLoad(int n)
 {
-	PARSETREE left, temp = NULL, fact();
+	void **prog, *tree, *q;
+	char expr[64], *p, mess[1024], *lib;
+	size_t size = 0, off, used;
+	double t0, t1, t2;
+	int i, err;
+
+	prog = (void **)malloc(n * sizeof(void *));
+	t0 = nowNs();
+	for (i = 0; i < n; i++)
+	{
+		sprintf(expr, "%d.5*sin(t)*exp(-t/%d)+sqrt(t*%d)", i, i + 1, i);
+		p = expr;
+		tree = parse(&p, &err, mess);
+		prog[i] = compile(tree, &err);
+		disposParseTree(tree);
+	}
+	t1 = nowNs();
 
-	temp = left = fact();
+	for (i = 0; i < n; i++)
+		size += writeProgram(prog[i], NULL, 0);
+	lib = (char *)malloc(size);
+	for (off = 0, i = 0; i < n; i++)
+		off += writeProgram(prog[i], lib + off, size - off);
 
-	if (match("<="))
+	t2 = nowNs();
+	for (off = 0; off < size; off += used)
 	{
-		advance(2);
-		temp = binOpNode(3, left, term());
+		q = readProgram(lib + off, size - off, &used, &err);
+		if (q == NULL)
+			break;
 	}
+	t2 = nowNs() - t2;
+
+	printf("load%-6d parse+compile %9.1f ns  readProgram %9.1f ns  %lu bytes\n",
+		   n, (t1 - t0) / n, t2 / n, (unsigned long)size);
+
+	for (i = 0; i < n; i++)
+		disposProgram(prog[i]);
+	free(prog);
+	free(lib);
+}
 
-	else if (match("<"))
+/*---------------------------------------------------
+	A sum of terms each in its own variable, with a
+	few of them changed between evaluations.
+---------------------------------------------------*/
+static void benchIncremental(int terms, long reps)
+{
+	static int change[] = {0, 1, 8, 64};
+	void *tree, *incr;
+	char *s, *p, mess[1024], name[16];
+	double t0, t1;
+	long i;
+	int j, k, err, *h;
+
+	h = (int *)malloc(terms * sizeof(int));
+	for (j = 0; j < terms; j++)
 	{
-		advance(1);
-		temp = binOpNode(4, left, term());
+		sprintf(name, "v%d", j);
+		h[j] = defineVariable(name, 0.0);
+	}
+	s = (char *)malloc(terms * 64 + 8);
+	p = s;
+	for (j = 0; j < terms; j++)
+		p += sprintf(p, "%sexp(-v%d)*sin(v%d*3)+sqrt(v%d+1)",
+					 j ? "+" : "", j, j, j);
+	p = s;
+	tree = parse(&p, &err, mess);
+	incr = newIncremental(tree, &err);
+
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariableByHandle(h[i % terms], (long double)i);
+		eval(tree, &err);
 	}
+	t1 = nowNs();
+	printf("incr%-6d eval %9.1f ns\n", terms, (t1 - t0) / reps);
 
-	else if (match(">="))
+	for (k = 0; k < (int)(sizeof(change) / sizeof(change[0])); k++)
 	{
-		advance(2);
-		temp = binOpNode(5, left, term());
+		t0 = nowNs();
+		for (i = 0; i < reps; i++)
+		{
+			for (j = 0; j < change[k] && j < terms; j++)
+				setVariableByHandle(h[(i + j) % terms], (long double)i);
+			evalIncremental(incr, &err);
+		}
+		t1 = nowNs();
+		printf("incr%-6d evalIncremental %9.1f ns  %d changed\n", terms,
+			   (t1 - t0) / reps, change[k] < terms ? change[k] : terms);
 	}
-	else if (match(">"))
+
+	disposIncremental(incr);
+	disposParseTree(tree);
+	free(s);
+	free(h);
+}
+
+/*---------------------------------------------------
+	nexpr channels over the same t, each its own
+	eval() against one evalMultiBatch().
+---------------------------------------------------*/
+static void benchMulti(int nexpr, int n)
+{
+	void **tree, *multi;
+	char expr[128], *p, mess[1024];
+	double *t, *out, t0, t1, t2;
+	int i, j, err;
+
+	tree = (void **)malloc(nexpr * sizeof(void *));
+	t = (double *)malloc(n * sizeof(double));
+	out = (double *)malloc(n * nexpr * sizeof(double));
+	for (i = 0; i < nexpr; i++)
 	{
-		advance(1);
-		temp = binOpNode(6, left, term());
+		sprintf(expr, "%d.5*sin(t)*exp(-t/%d)+t^2*cos(t)/%d", i, i % 7 + 1,
+				i + 1);
+		p = expr;
+		tree[i] = parse(&p, &err, mess);
 	}
-	else if (match("=="))
+	for (j = 0; j < n; j++)
+		t[j] = j * 0.001;
+
+	t0 = nowNs();
+	for (j = 0; j < n; j++)
 	{
-		advance(2);
-		temp = binOpNode(7, left, term());
+		setVariable("t", t[j]);
+		for (i = 0; i < nexpr; i++)
+			out[j * nexpr + i] = (double)eval(tree[i], &err);
+	}
+	t1 = nowNs();
+	multi = newMultiEval(tree, nexpr, &err);
+	t2 = nowNs();
+	evalMultiBatch(multi, t, out, n, NULL);
+	t2 = nowNs() - t2;
+
+	printf("multi%-5d eval %9.1f ns  evalMultiBatch %9.1f ns  per sample\n",
+		   nexpr, (t1 - t0) / n, t2 / n);
+
+	disposMultiEval(multi);
+	for (i = 0; i < nexpr; i++)
+		disposParseTree(tree[i]);
+	free(tree);
+	free(t);
+	free(out);
+}
+
+/*---------------------------------------------------
+	The same expressions written in C, to time the
+	native code against.
+---------------------------------------------------*/
+static double cShort(double t)
+{
+	return (2 * sin(t) + pow(t, 2));
+}
+
+static double cPoly(double t)
+{
+	return (((t * 0.5 + 1) * 0.5 + 2) * 0.5 + 3);
+}
+
+static double cDamped(double t)
+{
+	return (exp(-t) * sin(t) + exp(-t) * cos(t) + sqrt(exp(-t)));
+}
+
+static void benchNative(char *name, char *expr, double (*cf)(double),
+						long reps)
+{
+	void *tree, *prog, *nat;
+	double (*fn)(const double *), (*volatile c)(double) = cf;
+	char *p, mess[1024];
+	double vars[1], t0, t1, t2, t3, t4, t5;
+	int err;
+	long i;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	prog = compile(tree, &err);
+	nat = compileNative(tree, &err);
+	fn = nativeFunction(nat);
+
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariable("t", (long double)i * 1e-3);
+		eval(tree, &err);
 	}
-	else if (match("!="))
+	t1 = nowNs();
+	for (i = 0; i < reps; i++)
 	{
-		advance(2);
-		temp = binOpNode(8, left, term());
+		setVariable("t", (long double)i * 1e-3);
+		evalCompiled(prog, &err);
 	}
+	t2 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariable("t", (long double)i * 1e-3);
+		evalNative(nat, &err);
+	}
+	t3 = nowNs();
+	for (i = 0; fn != NULL && i < reps; i++)
+	{
+		vars[0] = i * 1e-3;
+		fn(vars);
+	}
+	t4 = nowNs();
+	for (i = 0; i < reps; i++)
+		c(i * 1e-3);
+	t5 = nowNs();
+
+	printf("%-10s eval %7.1f  compiled %6.1f  evalNative %6.1f  "
+		   "function %6.1f  C %6.1f ns%s\n",
+		   name, (t1 - t0) / reps, (t2 - t1) / reps, (t3 - t2) / reps,
+		   (t4 - t3) / reps, (t5 - t4) / reps,
+		   (fn == NULL) ? "  (no native code)" : "");
+
+	disposNative(nat);
+	disposProgram(prog);
+	disposParseTree(tree);
+}
 
-	return (temp);
+/*---------------------------------------------------
+	checkNative() compares evalNative() with eval(),
+	error codes included, for operands that are NaN
+	or infinite, which the native code hands back
+	to the interpreter.
+---------------------------------------------------*/
+static void checkNative(void)
+{
+	static char *expr[] = {
+		"sqrt((0-1)^0.5)", "log(tan(t)^0.5)", "ln(t^0.5)",
+		"sqrt(t^0.5)", "ln((t-t)*(1/0.0))", "sqrt(exp(1000*t)-exp(1000*t))",
+		"tan(t^0.5)", "t^0.5%3", "3%(t^0.5)", "1/(t^0.5)", NULL};
+	static long double at[] = {-2.0, -1.0, 0.0, 2.0, 1000.0};
+	void *tree, *nat;
+	char *p, mess[1024];
+	long double r1, r2;
+	int i, k, e1, e2, err, n = 0, bad = 0;
+
+	for (i = 0; expr[i] != NULL; i++)
+	{
+		p = expr[i];
+		tree = parse(&p, &err, mess);
+		nat = compileNative(tree, &err);
+		for (k = 0; k < (int)(sizeof(at) / sizeof(at[0])); k++)
+		{
+			setVariable("t", at[k]);
+			r1 = eval(tree, &e1);
+			r2 = evalNative(nat, &e2);
+			n++;
+			if (e1 != e2 || (!e1 && r1 == r1 &&
+							 fabsl(r1 - r2) > 1e-12 * (1 + fabsl(r1))))
+			{
+				printf("native %s at t=%Lg: %Lg/%d, eval %Lg/%d\n",
+					   expr[i], at[k], r2, e2, r1, e1);
+				bad++;
+			}
+		}
+		disposNative(nat);
+		disposParseTree(tree);
+	}
+	printf("native NaN check: %d cases, %d differ\n", n, bad);
 }
 
-/*************************** fact()  *************************************\
-\*-----------------------------------------------------------------------*/
+/*---------------------------------------------------
+	benchEmit() builds the source from emitC() with
+	the system C compiler, loads it, checks it gives
+	what eval() does at random t, errors included,
+	and times the two.
+---------------------------------------------------*/
+#if HAVE_POSIX
+#include <dlfcn.h>
+
+static void benchEmit(char *name, char *expr, long reps)
+{
+	long double (*fn)(const long double *, int *);
+	void *tree, *lib;
+	char *p, *src, mess[1024], c[64], so[64], cmd[256];
+	long double v[4], r1, r2;
+	double t0, t1, t2;
+	int err, e1, e2, bad = 0, nerr = 0;
+	size_t size;
+	FILE *fp;
+	long i;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	size = emitC(tree, "f", PREC_DEFAULT, NULL, 0);
+	src = (char *)malloc(size);
+	emitC(tree, "f", PREC_DEFAULT, src, size);
+
+	sprintf(c, "/tmp/emit%d.c", (int)getpid());
+	sprintf(so, "/tmp/emit%d.so", (int)getpid());
+	sprintf(cmd, "cc -O3 -march=native -shared -fPIC -o %s %s -lm", so, c);
+	fp = fopen(c, "w");
+	fprintf(fp, "#include <math.h>\n\n%s", src);
+	fclose(fp);
+	lib = NULL;
+	if (system(cmd) != 0 || (lib = dlopen(so, RTLD_NOW)) == NULL)
+	{
+		printf("%-10s emitC source did not build\n", name);
+		goto done;
+	}
+	*(void **)&fn = dlsym(lib, "f");
+
+	srand(1);
+	for (i = 0; i < reps; i++)
+	{
+		v[0] = (rand() % 2001 - 1000) / 100.0;
+		setVariable("t", v[0]);
+		r1 = eval(tree, &e1);
+		r2 = fn(v, &e2);
+		if (e1 != e2 || (r1 != r2 && !(r1 != r1 && r2 != r2)))
+			bad++;
+		nerr += (e1 != 0);
+	}
+
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		setVariable("t", (long double)i * 1e-3);
+		eval(tree, &e1);
+	}
+	t1 = nowNs();
+	for (i = 0; i < reps; i++)
+	{
+		v[0] = i * 1e-3;
+		fn(v, &e2);
+	}
+	t2 = nowNs();
+
+	printf("%-10s eval %7.1f ns  emitC %6.1f ns  %ld random t, %d errors, "
+		   "%s\n",
+		   name, (t1 - t0) / reps, (t2 - t1) / reps, reps, nerr,
+		   bad ? "MISMATCH" : "ok");
+
+	dlclose(lib);
+done:
+	remove(c);
+	remove(so);
+	free(src);
+	disposParseTree(tree);
+}
+#endif
 
-static PARSETREE fact(void)
+/*---------------------------------------------------
+	The graphing loop of setVariable() and eval()
+	against tabulate() over the same range.
+---------------------------------------------------*/
+static void benchTabulate(char *name, char *expr, long n)
+{
+	void *tree;
+	char *p, mess[1024];
+	double *out, t0, t1, t2, t3;
+	int err;
+	long i;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	out = (double *)malloc(n * sizeof(double));
+
+	t0 = nowNs();
+	for (i = 0; i < n; i++)
+	{
+		setVariable("t", 10.0 * i / (n - 1));
+		out[i] = (double)eval(tree, &err);
+	}
+	t1 = nowNs();
+	tabulateCtx(&DefaultCtx, tree, "t", 0.0, 10.0, n, out, NULL, 1);
+	t2 = nowNs();
+	tabulate(tree, "t", 0.0, 10.0, n, out);
+	t3 = nowNs();
+
+	printf("%-10s eval loop %7.1f ns  tabulate 1 thread %6.1f ns  "
+		   "all %6.1f ns\n",
+		   name, (t1 - t0) / n, (t2 - t1) / n, (t3 - t2) / n);
+
+	free(out);
+	disposParseTree(tree);
+}
 
+/*---------------------------------------------------
+	Looking for the roots in [0, 50] one piece at
+	a time, with one evalInterval() per piece
+	against 16 calls to eval(), and how many of
+	the pieces the bounds rule out.
+---------------------------------------------------*/
+static void benchInterval(char *name, char *expr, long n)
 {
-	PARSETREE left, temp = NULL, part();
+	void *tree;
+	char *p, mess[1024];
+	long double lo, hi, y, w;
+	double t0, t1, t2;
+	int err, sign;
+	long i, j, keep, change;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	w = 50.0 / n;
+
+	t0 = nowNs();
+	for (i = change = 0; i < n; i++)
+		for (j = sign = 0; j <= 16; j++)
+		{
+			setVariable("t", (i + j / 16.0) * w);
+			y = eval(tree, &err);
+			if (j && (y > 0) != sign)
+			{
+				change++;
+				break;
+			}
+			sign = (y > 0);
+		}
+	t1 = nowNs();
+	for (i = keep = 0; i < n; i++)
+		if (evalInterval(tree, "t", i * w, (i + 1) * w, &lo, &hi) ||
+			(lo <= 0.0 && hi >= 0.0))
+			keep++;
+	t2 = nowNs();
+
+	printf("%-10s %ld pieces: 16 evals %7.1f ns  evalInterval %6.1f ns  "
+		   "%ld kept, %ld with a sign change\n",
+		   name, n, (t1 - t0) / n, (t2 - t1) / n, keep, change);
+
+	disposParseTree(tree);
+}
 
-	temp = left = part();
+/*---------------------------------------------------
+	A slope from the compiled derivative against a
+	central difference of two evaluations, and the
+	largest gap between them over [0.1, 10].
+---------------------------------------------------*/
+static void benchDerivative(char *name, char *expr, long n)
+{
+	void *tree, *d, *pf, *pd;
+	char *p, mess[1024];
+	long double x, y, h, sum, gap;
+	double t0, t1, t2;
+	int err;
+	long i;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+	d = differentiate(tree, "t", &err);
+	pf = compile(tree, &err);
+	pd = compile(d, &err);
+
+	sum = 0.0;
+	t0 = nowNs();
+	for (i = 0; i < n; i++)
+	{
+		setVariable("t", 0.1 + 9.9 * i / n);
+		sum += evalCompiled(pd, &err);
+	}
+	t1 = nowNs();
+	for (i = 0; i < n; i++)
+	{
+		x = 0.1 + 9.9 * i / n;
+		h = 1e-6 * (1 + x);
+		setVariable("t", x + h);
+		y = evalCompiled(pf, &err);
+		setVariable("t", x - h);
+		sum -= (y - evalCompiled(pf, &err)) / (2 * h);
+	}
+	t2 = nowNs();
 
-	if (match("+"))
+	for (i = 0, gap = 0.0; i < 1000; i++)
 	{
-		advance(1);
-		temp = binOpNode(9, left, fact());
+		x = 0.1 + 9.9 * i / 1000;
+		h = 1e-6 * (1 + x);
+		setVariable("t", x + h);
+		y = evalCompiled(pf, &err);
+		setVariable("t", x - h);
+		y = (y - evalCompiled(pf, &err)) / (2 * h);
+		setVariable("t", x);
+		y = fabsl(y - evalCompiled(pd, &err)) / (1 + fabsl(y));
+		if (y > gap)
+			gap = y;
 	}
-	else if (match("-"))
+
+	printf("%-10s derivative %6.1f ns  central difference %6.1f ns  "
+		   "largest gap %.1Le (%Lg)\n",
+		   name, (t1 - t0) / n, (t2 - t1) / n, gap, sum);
+
+	disposProgram(pd);
+	disposProgram(pf);
+	disposParseTree(d);
+	disposParseTree(tree);
+}
+
+static void benchPrec(char *name, char *expr, long reps)
+{
+	static char *label[] = {"default", "float", "double", "long"};
+	void *tree;
+	char *p, mess[1024];
+	int err, prec;
+	long i;
+	double t0, t1;
+	long double v;
+
+	p = expr;
+	tree = parse(&p, &err, mess);
+
+	printf("%-10s", name);
+	for (prec = PREC_DEFAULT; prec <= PREC_LONG; prec++)
 	{
-		advance(1);
-		temp = binOpNode(10, left, fact());
+		v = 0.0;
+		t0 = nowNs();
+		for (i = 0; i < reps; i++)
+		{
+			setVariable("t", (long double)i * 1e-3);
+			v += evalPrec(tree, prec, &err);
+		}
+		t1 = nowNs();
+		printf(" %s %6.1f ns", label[prec], (t1 - t0) / reps);
 	}
+	printf("\n");
 
-	return (temp);
+	disposParseTree(tree);
 }
 
-/*************************** part()  *************************************\
-\*-----------------------------------------------------------------------*/
-
-static PARSETREE part(void)
+static void benchVars(long reps)
+{
+	static char *name[] = {"x", "y", "z", "vx", "vy", "vz",
+						   "mass", "drag", "lift", "thrust", "gravity", "dt"};
+	int h[12], i, k;
+	double t0, t1, t2;
+
+	for (k = 0; k < 12; k++)
+		h[k] = defineVariable(name[k], 0.0);
+
+	t0 = nowNs();
+	for (i = 0; i < reps; i++)
+		for (k = 0; k < 12; k++)
+			setVariable(name[k], (long double)(i + k));
+	t1 = nowNs();
+	for (i = 0; i < reps; i++)
+		for (k = 0; k < 12; k++)
+			setVariableByHandle(h[k], (long double)(i + k));
+	t2 = nowNs();
+
+	printf("12 inputs  by name %7.1f ns  by handle %6.1f ns  speedup %5.2fx\n",
+		   (t1 - t0) / reps, (t2 - t1) / reps, (t1 - t0) / (t2 - t1));
+}
 
+static void benchFootprint(long n)
 {
-	PARSETREE left, temp = NULL, part2();
+	void **trees;
+	TREE *t;
+	char buf[128], *p, mess[1024];
+	double t0, t1, bytes = 0.0, nodes = 0.0;
+	int err;
+	long i;
 
-	temp = left = part2();
+	trees = (void **)malloc(n * sizeof(void *));
 
-	if (match("*"))
-	{
-		advance(1);
-		temp = binOpNode(11, left, part());
-	}
-	else if (match("%"))
+	t0 = nowNs();
+	for (i = 0; i < n; i++)
 	{
-		advance(1);
-		temp = binOpNode(12, left, part());
+		sprintf(buf, "%ld*sin(t)+t^%ld-%ld.5/(t+%ld)", i % 97, i % 5, i, i % 13);
+		p = buf;
+		trees[i] = parse(&p, &err, mess);
 	}
-	else if (match("/"))
-	{
-
-		/*---------------------------------------------------------------
-			This code makes sure that division is done left to right.
-			i.e. 2/3/2 = (2/3)/2 = .333333
-		 ---------------------------------------------------------------*/
+	t1 = nowNs();
 
-		while (match("/"))
+	for (i = 0; i < n; i++)
+		for (t = (TREE *)trees[i]; t != NULL; t = t->next)
 		{
-			advance(1);
-			left = binOpNode(13, left, part2());
+			bytes += TREEHDR + t->size * sizeof(node);
+			nodes += t->used;
 		}
 
-		if (*Str == '*')
-		{
-			advance(1);
-			temp = binOpNode(11, left, part());
-		}
-		else if (*Str == '%')
-		{
-			advance(1);
-			temp = binOpNode(12, left, part());
-		}
-		else
-			temp = left;
-	}
+	printf("%ld formulas  node %d bytes  %.1f nodes  %.1f bytes each  "
+		   "%.1f MB  parse %.1f ns\n",
+		   n, (int)sizeof(node), nodes / n, bytes / n, bytes / 1048576.0,
+		   (t1 - t0) / n);
 
-	return (temp);
+	for (i = 0; i < n; i++)
+		disposParseTree(trees[i]);
+	free(trees);
 }
 
-/*************************** part2()  *************************************\
-\*-----------------------------------------------------------------------*/
+/*---------------------------------------------------
+	The suite times a fixed corpus, each kind of
+	expression the parser and evaluators see, and
+	prints one JSON object a line so that runs can
+	be kept and compared. A measure is taken SAMPLES
+	times, each a run long enough for the clock,
+	and given as percentiles of the cost of one.
+---------------------------------------------------*/
+#define SAMPLES 101
+#define SAMPLENS 20000.0 /* shortest run of one sample */
+
+typedef struct suiteExpr
+{
+	char *kind;
+	char *expr;
+} SUITEEXPR;
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
 
-static PARSETREE part2(void)
+	return ((x > y) - (x < y));
+}
 
+/*---- one line of results, per divides the time of one run ----*/
+static void suiteReport(char *bench, char *kind, char *unit, double *ns,
+						double per)
 {
-	PARSETREE left = NULL, get_constant();
-	PARSETREE temp = NULL;
-	// double pow() ;
+	int i;
+
+	for (i = 0; i < SAMPLES; i++)
+		ns[i] /= per;
+	qsort(ns, SAMPLES, sizeof(double), cmpDouble);
+	printf("{\"bench\": \"%s\", \"kind\": \"%s\", \"unit\": \"%s\", "
+		   "\"samples\": %d, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+		   "\"p99\": %.3f}\n",
+		   bench, kind, unit, SAMPLES, ns[0], ns[SAMPLES / 2],
+		   ns[SAMPLES * 9 / 10], ns[SAMPLES * 99 / 100]);
+}
 
-	temp = left = get_constant();
+/*---------------------------------------------------
+	SUITETIME(ns, what) fills ns[] with the time of
+	one run of what, each sample running it as many
+	times as it takes to be SAMPLENS long.
+---------------------------------------------------*/
+#define SUITETIME(ns, what)                           \
+	{                                                 \
+		long reps_, r_;                               \
+		double t_;                                    \
+		int s_;                                       \
+                                                      \
+		for (reps_ = 1;; reps_ *= 2)                  \
+		{                                             \
+			t_ = nowNs();                             \
+			for (r_ = 0; r_ < reps_; r_++)            \
+				what;                                 \
+			if (nowNs() - t_ >= SAMPLENS)             \
+				break;                                \
+		}                                             \
+		for (s_ = 0; s_ < SAMPLES; s_++)              \
+		{                                             \
+			t_ = nowNs();                             \
+			for (r_ = 0; r_ < reps_; r_++)            \
+				what;                                 \
+			ns[s_] = (nowNs() - t_) / reps_;          \
+		}                                             \
+	}
 
-	if (match("^"))
+static void benchSuite(void)
+{
+	static char *vars[] = {"x", "y", "z", "u", "v", "w", "k", "mass", "drag"};
+	SUITEEXPR corpus[] = {
+		{"shallow", "2*t+1"},
+		{"poly", "t*t-3*t+2"},
+		{"deep", NULL},
+		{"functions", "sin(t)*cos(t)+tan(t/3)+exp(-t)*ln(t+2)+sqrt(t+1)+"
+					  "log(t+5)"},
+		{"variables", "x*u+y*v+z*w-(mass*x*x+drag*y)/(1+k*k)+T*t"},
+		{"long", NULL},
+	};
+	int ncorpus = sizeof(corpus) / sizeof(corpus[0]);
+	void *tree, *prog;
+	char *p, mess[1024];
+	double ns[SAMPLES], *t, *out;
+	int i, err, nodes, nconst;
+	size_t len;
+
+	for (i = 0; i < (int)(sizeof(vars) / sizeof(vars[0])); i++)
+		defineVariable(vars[i], 0.5 + i);
+	corpus[2].expr = nested(64);
+	corpus[5].expr = chain(200);
+
+	t = (double *)malloc(BATCH * 16 * sizeof(double));
+	out = (double *)malloc(BATCH * 16 * sizeof(double));
+	for (i = 0; i < BATCH * 16; i++)
+		t[i] = i * 1e-4;
+	setVariable("t", 0.25);
+
+	for (i = 0; i < ncorpus; i++)
 	{
-		advance(1);
-		temp = binOpNode(14, left, part2());
+		len = strlen(corpus[i].expr);
+		SUITETIME(ns, (p = corpus[i].expr,
+					   disposParseTree(parse(&p, &err, mess))));
+		suiteReport("parse", corpus[i].kind, "ns/char", ns, len);
+
+		p = corpus[i].expr;
+		tree = parse(&p, &err, mess);
+		prog = compile(tree, &err);
+		nodes = nconst = 0;
+		countNodes(((TREE *)tree)->root, &nodes, &nconst);
+
+		SUITETIME(ns, eval(tree, &err));
+		suiteReport("eval", corpus[i].kind, "ns/node", ns, nodes);
+		SUITETIME(ns, evalCompiled(prog, &err));
+		suiteReport("evalCompiled", corpus[i].kind, "ns/node", ns, nodes);
+		SUITETIME(ns, evalBatch(tree, t, out, BATCH * 16, NULL));
+		suiteReport("evalBatch", corpus[i].kind, "ns/element", ns,
+					BATCH * 16);
+
+		disposProgram(prog);
+		disposParseTree(tree);
 	}
 
-	return (temp);
+	free(out);
+	free(t);
+	free(corpus[2].expr);
+	free(corpus[5].expr);
 }
-/*************************** myAtof()  ***********************************\
-\*-----------------------------------------------------------------------*/
-
-static long double myAtof(void)
 
+int main(int argc, char *argv[])
 {
-	long double val = 0.0, power = 1.0, temp = 1.0, ex = 0;
-	int i, sign = 1, sn = 1;
+	char *s, buf[32];
+	int i;
 
-	while (*Str == ' ' || *Str == '\n' || *Str == '\t')
-		Str++;
-
-	for (;;)
+	if (argc > 1 && strcmp(argv[1], "suite") == 0)
 	{
-		if (match("+"))
-		{
-			advance(1);
-		}
-		else if (match("-"))
-		{
-			advance(1);
-			sign *= -1;
-		}
-		else
-			break;
+		benchSuite();
+		return (0);
 	}
 
-	while (*Str == ' ' || *Str == '\n' || *Str == '\t')
-		Str++;
+	benchCompiled("short", "2*sin(t)+t^2", 2000000);
 
-	if ((*Str < '0' || *Str > '9') && *Str != '.')
-		error(" unexpected symbol ");
+	s = nested(16);
+	benchCompiled("nested16", s, 1000000);
+	free(s);
 
-	for (val = 0; (*Str >= '0') && (*Str <= '9'); Str++)
-		val = 10.0 * val + (*Str - '0');
+	s = nested(256);
+	benchCompiled("nested256", s, 50000);
+	free(s);
 
-	if (*Str == '.')
-	{
-		Str++;
+	s = chain(64);
+	benchCompiled("chain64", s, 100000);
+	free(s);
 
-		for (power = 1; (*Str >= '0') && (*Str <= '9'); Str++)
-		{
-			val = 10.0 * val + (*Str - '0');
-			power *= 10;
-		}
-	}
+	benchCompiled("repeat", "sin(t)*sin(t)+cos(t)*sin(t)", 2000000);
+	benchCompiled("damped", "exp(-t)*sin(t)+exp(-t)*cos(t)+sqrt(exp(-t))",
+				  2000000);
 
-	while (*Str == ' ' || *Str == '\n' || *Str == '\t')
-		Str++;
+	benchBatch("plot", "sin(t)*exp(-t)", 1000000);
+	benchBatch("poly", "((t*0.5+1)*0.5+2)*0.5+3", 1000000);
+	benchBatch("repeat", "sin(t)*sin(t)+cos(t)*sin(t)", 1000000);
 
-	temp = 1;
+	benchOptimize("units", "t*1000/3600*1.609344+2*pi/4*sin(t)+0*t", 1000000);
 
-	if (*Str == 'e' || *Str == 'E')
+	benchParallel("sweep", "sin(t)*exp(-t)+sqrt(t)*cos(3*t)", 20000000);
+
+	benchParse("short", "2*sin(t)+t^2", 1000000);
+	s = nested(256);
+	benchParse("nested256", s, 20000);
+	free(s);
+	s = chain(100000);
+	benchParse("chain100k", s, 20);
+	benchCompiled("chain100k", s, 20);
+	free(s);
+
+	benchFootprint(100000);
+
+	benchVars(2000000);
+	benchParse("names", "x*sin(t)+sqrt(pi*vz)-exp(t)", 1000000);
+	for (i = 0; i < 500; i++)
 	{
+		sprintf(buf, "v%d", i);
+		defineVariable(buf, 0.0);
+	}
+	benchParse("names500", "x*sin(t)+sqrt(pi*vz)-exp(t)", 1000000);
 
-		Str++;
+	benchPrec("damped", "exp(-t)*sin(t)+exp(-t)*cos(t)+sqrt(exp(-t))",
+			  2000000);
+	benchPrec("poly", "((t*0.5+1)*0.5+2)*0.5+3", 2000000);
 
-		while (*Str == ' ' || *Str == '\n' || *Str == '\t')
-			Str++;
+	s = coefficients(1000);
+	benchParse("coef1000", s, 2000);
+	benchCache("coef1000", s, 2000);
+	free(s);
 
-		for (;;)
-		{
-			if (match("+"))
-			{
-				advance(1);
-			}
-			else if (match("-"))
-			{
-				advance(1);
-				sn *= -1;
-			}
-			else
-				break;
-		}
+	benchCache("names", "x * sin(t) + sqrt(pi*vz) - exp(t)", 1000000);
 
-		while (*Str == ' ' || *Str == '\n' || *Str == '\t')
-			Str++;
+	benchLoad(10000);
 
-		if (*Str < '0' || *Str > '9')
-			error(" unexpected symbol ");
+	benchIncremental(64, 200000);
 
-		for (ex = 0; (*Str >= '0') && (*Str <= '9'); Str++)
-			ex = 10.0 * ex + (*Str - '0');
+	benchMulti(200, 2000);
 
-		temp = pow((long double)10.0, (long double)ex * (long double)sn);
-	}
+	benchNative("short", "2*sin(t)+t^2", cShort, 2000000);
+	benchNative("poly", "((t*0.5+1)*0.5+2)*0.5+3", cPoly, 2000000);
+	benchNative("damped", "exp(-t)*sin(t)+exp(-t)*cos(t)+sqrt(exp(-t))",
+				cDamped, 2000000);
+	checkNative();
 
-	return (sign * val * temp / power);
-}
+#if HAVE_POSIX
+	benchEmit("damped", "exp(-t)*sin(t)+exp(-t)*cos(t)+sqrt(exp(-t))",
+			  1000000);
+	benchEmit("checks", "sqrt(t)/(t-1)+ln(t+5)*tan(t)+t%3", 1000000);
+#endif
 
-/*************************** get_constant()  ************************************\
-\*-----------------------------------------------------------------------*/
-static PARSETREE get_constant(void)
+	benchTabulate("plot", "sin(t)*exp(-t)", 4000000);
+	benchTabulate("damped", "exp(-t)*sin(t)+exp(-t)*cos(t)+sqrt(exp(-t))",
+				  4000000);
 
-{
-	PARSETREE temp = NULL, func();
+	benchInterval("roots", "sin(t)*exp(-t/5)-0.1", 4096);
+	benchInterval("checks", "sqrt(t)/(t-1)+ln(t+5)*tan(t)-1", 4096);
 
-	if (match("+"))
-	{
-		advance(1);
-		temp = get_constant();
-	}
-	else if (match("-"))
-	{
-		advance(1);
-		temp = unarOpNode(10, get_constant());
-	}
-	else if (match("!"))
-	{
-		advance(1);
-		temp = unarOpNode(0, get_constant());
-	}
-	else
-	{
-		temp = func();
-	}
+	benchDerivative("damped", "sin(t)*exp(-t/5)-0.1", 1000000);
+	benchDerivative("rational", "(t^3-2*t+1)/(t^2+1)+sqrt(t)*ln(t)", 1000000);
 
-	return (temp);
+	return (0);
 }
 
-/*************************** func()  ************************************\
+/*************************** main()  *************************************\
+
+	With no arguments the test program reads an expression a line and
+	prints its value and error codes, whether its input is a terminal
+	or not.
+
+	Given arguments, if only - for its input, it evaluates a stream of
+	rows instead, one result a line in the same order,
+
+		parseTree [-c var,var,...] [-j threads] [file ...]
+
+	Each row is an expression, then with -c a comma and the values of
+	the variables named, in that order. A column that is missing is 0,
+	so that each row stands alone and the results are the same for
+	any number of threads. The result is the value, or
+	"error n" with the code eval() sets, "parse error n", or "bad
+	value k" when the k'th value is not a number. Files are
+	mapped where they can be, and a pipe or "-" for stdin is read a
+	large block at a time. A row with the same expression as the one
+	before reuses its tree and the others come from an expression
+	cache, so a formula is parsed once however many rows use it. -j
+	shares each run of rows among that many threads, or one for each
+	processor with -j 0.
+
+		parseTree -r var,start,stop,n [-b] [-j threads] expression
+
+	tabulates the expression instead, with tabulate(), a row for each
+	value of var with it and the result. With -b only the results are
+	written, as doubles in the byte order of the machine with a NaN
+	for an error. The table is made and written a million rows at a
+	time, so it may be larger than memory.
+
 \*-----------------------------------------------------------------------*/
 
-static PARSETREE func(void)
+#elif MAIN
+
+/*---------------------------------------------------
+	Rows are handed to the threads STREAMROWS at a
+	time, each thread taking an equal run of them
+	and writing its results to its own buffer, the
+	buffers then going out in order.
+---------------------------------------------------*/
+#define STREAMROWS 65536
+#define STREAMREAD (4 << 20) /* bytes read from a pipe at a time */
 
+typedef struct streamJob
 {
-	PARSETREE temp = NULL;
-	long double rval = 0.0;
+	char **row; /* the rows of this job, and their lengths */
+	size_t *len;
+	int n;
+	void *ctx;
+	char *line; /* a copy of the row being worked on */
+	size_t room;
+	char *out; /* the results */
+	size_t nout, outroom;
+	char *last; /* the expression of the row before, and its tree */
+	void *tree;
+	int perr;
+} STREAMJOB;
+
+typedef struct stream
+{
+	void *cache;
+	int *handle; /* the variables of the columns after the expression */
+	int ncol;
+	STREAMJOB *job;
+	int njob;
+	char *row[STREAMROWS];
+	size_t len[STREAMROWS];
+	int bad; /* out of memory */
+} STREAM;
+
+static STREAM Stream;
+
+/*---- room for more bytes in *buf ----*/
+static int streamRoom(char **buf, size_t *room, size_t need)
+{
+	char *b;
 
-	if (match("("))
-	{
-		/* get expression */
-		advance(1);
-		temp = expr();
+	if (need <= *room)
+		return (1);
+	if ((b = (char *)realloc(*buf, 2 * need)) == NULL)
+		return (0);
+	*buf = b;
+	*room = 2 * need;
+	return (1);
+}
 
-		if (match(")"))
+static void *streamRows(void *arg)
+{
+	STREAMJOB *j = (STREAMJOB *)arg;
+	PARSERCTX num;
+	char *p, *f, mess[1024];
+	long double v;
+	int i, k, err;
+
+	j->nout = 0;
+	for (i = 0; i < j->n; i++)
+	{
+		if (!streamRoom(&j->line, &j->room, j->len[i] + 1) ||
+			!streamRoom(&j->out, &j->outroom, j->nout + 64))
 		{
-			advance(1);
+			Stream.bad = 1;
+			break;
 		}
-		else
+		memcpy(j->line, j->row[i], j->len[i]);
+		j->line[j->len[i]] = '\0';
+		if (j->len[i] > 0 && j->line[j->len[i] - 1] == '\r')
+			j->line[j->len[i] - 1] = '\0';
+		if (j->line[0] == '\0')
 		{
-			error(" Mis-matched parenthesis ");
-			return (NULL);
+			j->out[j->nout++] = '\n';
+			continue;
 		}
-	}
-	else if ((*Str >= 'a' && *Str <= 'z'))
-	{
-
-		int i;
-		char *n;
 
-		/*--------------------------
-			Check for a function
-		---------------------------*/
-
-		for (i = FUNCSTART; i < NUMRATOR; i++)
+		/*---------------------------------------------------
+			The expression ends at the first comma, then
+			come the values of the variables, read as the
+			parser reads numbers.
+		---------------------------------------------------*/
+		f = strchr(j->line, ',');
+		if (f != NULL)
+			*f++ = '\0';
+		num.ParseError = 0;
+		for (k = 0; k < Stream.ncol && !num.ParseError; k++)
 		{
-			n = OPRATOR[i];
-			if (match(n) &&
-				((*(Str + strlen(n)) < 'a') || (*(Str + strlen(n)) > 'z')))
-				break;
+			v = 0.0; /* a missing column, whatever the row before had */
+			if (f != NULL)
+			{
+				num.Str = num.Start_str = f;
+				num.err2Message[0] = '\0';
+				v = myAtof(&num);
+				f = strchr(num.Str, ',');
+				if (f != NULL)
+					f++;
+			}
+			setVariableByHandleCtx(j->ctx, Stream.handle[k], v);
 		}
-
-		if (i < NUMRATOR)
+		if (num.ParseError)
 		{
+			j->nout += sprintf(j->out + j->nout, "bad value %d\n", k);
+			continue;
+		}
 
-			advance(strlen(n));
-
-			if (!match("("))
+		/*---------------------------------------------------
+			Rows of the same expression keep its tree, the
+			others get theirs from the cache.
+		---------------------------------------------------*/
+		if (j->last == NULL || strcmp(j->last, j->line) != 0)
+		{
+			disposParseTree(j->tree);
+			free(j->last);
+			j->last = (char *)malloc(strlen(j->line) + 1);
+			if (j->last == NULL)
 			{
-				error(" Missing parenthesis ");
-				return (NULL);
+				j->tree = NULL;
+				Stream.bad = 1;
+				break;
 			}
+			strcpy(j->last, j->line);
+			p = j->line;
+			j->tree = cacheParse(Stream.cache, &p, &j->perr, mess);
+		}
 
-			advance(1);
-
-			temp = unarOpNode(i, expr());
-
-			if (match(")"))
-				advance(1);
+		if (j->perr)
+			j->nout += sprintf(j->out + j->nout, "parse error %d\n", j->perr);
+		else
+		{
+			v = evalCtx(j->ctx, j->tree, &err);
+			if (err)
+				j->nout += sprintf(j->out + j->nout, "error %d\n", err);
 			else
-			{
-				error(" Mis-matched parenthesis ");
-				return (NULL);
-			}
+				j->nout += sprintf(j->out + j->nout, "%.17Lg\n", v);
 		}
-		else
+	}
+	return (NULL);
+}
+
+/*---------------------------------------------------
+	streamLines() does the whole rows in buf[0..n),
+	and the last part row too if final, returning
+	the number of bytes it used.
+---------------------------------------------------*/
+static size_t streamLines(char *buf, size_t n, int final)
+{
+	char *p, *end, *nl;
+	int nrow, i, per;
+#if PARALLEL
+	pthread_t tid[64];
+	int started[64];
+#endif
+
+	p = buf;
+	end = buf + n;
+	while (p < end)
+	{
+		for (nrow = 0; nrow < STREAMROWS && p < end; nrow++)
 		{
-			/*----------------------------
-				Check for a variable .
-			-----------------------------*/
+			nl = (char *)memchr(p, '\n', end - p);
+			if (nl == NULL && !final)
+				break;
+			if (nl == NULL)
+				nl = end;
+			Stream.row[nrow] = p;
+			Stream.len[nrow] = nl - p;
+			p = (nl < end) ? nl + 1 : end;
+		}
+		if (nrow == 0)
+			break;
 
-			for (i = 0; i < num_var; i++)
-			{
-				n = VARIABLE[i].name;
-				if (match(n) &&
-					((*(Str + strlen(n)) < 'a') || (*(Str + strlen(n)) > 'z')))
-					break;
-			}
+		per = (nrow + Stream.njob - 1) / Stream.njob;
+		for (i = 0; i < Stream.njob; i++)
+		{
+			Stream.job[i].row = Stream.row + i * per;
+			Stream.job[i].len = Stream.len + i * per;
+			Stream.job[i].n = (nrow > i * per) ? nrow - i * per : 0;
+			if (Stream.job[i].n > per)
+				Stream.job[i].n = per;
+		}
+#if PARALLEL
+		for (i = 1; i < Stream.njob; i++)
+			started[i] = !pthread_create(&tid[i], NULL, streamRows,
+										 &Stream.job[i]);
+		streamRows(&Stream.job[0]);
+		for (i = 1; i < Stream.njob; i++)
+			if (started[i])
+				pthread_join(tid[i], NULL);
+			else
+				streamRows(&Stream.job[i]);
+#else
+		for (i = 0; i < Stream.njob; i++)
+			streamRows(&Stream.job[i]);
+#endif
+		for (i = 0; i < Stream.njob; i++)
+			fwrite(Stream.job[i].out, 1, Stream.job[i].nout, stdout);
+		if (nl == NULL)
+			break;
+	}
+	return (p - buf);
+}
 
-			if (i < num_var)
-			{
-				advance(strlen(n));
-				temp = numNode(i, 0.0);
-				if (temp == NULL)
-				{
-					error(" Out of memory");
-					return (NULL);
-				}
-			}
-			n = NULL;
+/*---- a file, mapped, or a pipe, read a block at a time ----*/
+static int streamFile(char *path)
+{
+	char *buf, *b;
+	size_t size, n, got;
+	FILE *fp;
+
+	if (strcmp(path, "-") != 0)
+	{
+		if ((buf = (char *)mapFile(path, &size)) != NULL)
+		{
+			streamLines(buf, size, 1);
+			unmapFile(buf, size);
+			return (0);
 		}
+		if ((fp = fopen(path, "rb")) == NULL)
+			return (1);
 	}
 	else
-	{ /* or, get number */
-		rval = myAtof();
-		temp = numNode(CONST, rval);
-	}
+		fp = stdin;
 
-	if (temp == NULL)
+	size = STREAMREAD;
+	n = 0;
+	if ((buf = (char *)malloc(size)) == NULL)
+		return (1);
+	while ((got = fread(buf + n, 1, size - n, fp)) > 0)
 	{
-		error(" unexpected symbol ");
-		return (NULL);
+		n += got;
+		got = streamLines(buf, n, 0);
+		memmove(buf, buf + got, n - got);
+		n -= got;
+		if (n == size)
+		{
+			/*---- one row longer than the buffer ----*/
+			if ((b = (char *)realloc(buf, 2 * size)) == NULL)
+				break;
+			buf = b;
+			size *= 2;
+		}
 	}
-
-	return (temp);
+	streamLines(buf, n, 1);
+	free(buf);
+	if (fp != stdin)
+		fclose(fp);
+	return (0);
 }
 
-/*************************** parse()  ************************************\
-\*-----------------------------------------------------------------------*/
+/*---------------------------------------------------
+	tabulateMain() writes expr over the range given
+	as var,start,stop,n, TABCHUNK values at a time,
+	so that the table need not fit in memory.
+---------------------------------------------------*/
+#define TABCHUNK (1 << 20)
 
-void *parse(char *expr_p[], int *err, char err_mess[])
+/*---- the next field of -r as a number, or 0 if it is not one ----*/
+static int rangeValue(double *v)
 {
-	PARSETREE rval;
+	char *s, *end;
 
-	Start_str = Str = *expr_p;
+	if ((s = strtok(NULL, ",")) == NULL || *s == '\0')
+		return (0);
+	*v = strtod(s, &end);
+	return (*end == '\0' && *v == *v);
+}
 
-	/*---------------------------------
-		Skip leading white space.
-		This was added on Jan 28,'89.
-	----------------------------------*/
-	while (*Str == ' ' || *Str == '\t')
+static int tabulateMain(char *expr, char *range, int binary, int nthread)
+{
+	PROGRAM *p;
+	RANGE r;
+	void *tree;
+	char *var, *s, *end, mess[1024];
+	double *x, *y;
+	int *e, bind, err;
+	size_t base, m, i;
+
+	var = strtok(range, ",");
+	if (var == NULL || expr == NULL || !rangeValue(&r.start) ||
+		!rangeValue(&r.stop) || (s = strtok(NULL, ",")) == NULL ||
+		*s < '0' || *s > '9' || (r.n = strtoull(s, &end, 10)) < 1 ||
+		*end != '\0')
+	{
+		fprintf(stderr, "use -r var,start,stop,n expression\n");
+		return (2);
+	}
+	if ((bind = defineVariable(var, 0.0)) < 0)
 	{
-		Str++;
+		fprintf(stderr, "cannot use %s as a variable\n", var);
+		return (2);
 	}
 
-	if (!Str || !*Str)
+	s = expr;
+	tree = parse(&s, &err, mess);
+	if (err)
 	{
-		*err = -1;
-		strcpy(err_mess, *expr_p);
-		strcat(err_mess, "\n Not a Function ");
-		rval = NULL;
+		fprintf(stderr, "%s\n", mess);
+		return (2);
 	}
-	else
+	p = (PROGRAM *)compile(tree, &err);
+	x = (double *)malloc(TABCHUNK * sizeof(double));
+	y = (double *)malloc(TABCHUNK * sizeof(double));
+	e = (int *)malloc(TABCHUNK * sizeof(int));
+	if (p == NULL || x == NULL || y == NULL || e == NULL)
+		err = -1;
+	setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+	/*---------------------------------------------------
+		Binary output is the values alone as doubles,
+		a NaN for an error. Text is a row for each,
+		var then the value or the error.
+	---------------------------------------------------*/
+	for (base = 0; base < r.n && !err; base += m)
 	{
-		ParseError = 0;
-		err1Message[0] = '\0';
-		err2Message[0] = '\0';
+		m = (r.n - base < TABCHUNK) ? r.n - base : TABCHUNK;
+		r.first = base;
+		if ((err = runPool(&DefaultCtx, p, bind, NULL, &r, y, e, m,
+						   nthread)) != 0)
+			break;
+		if (binary)
+		{
+			for (i = 0; i < m; i++)
+				if (e[i])
+					y[i] = NAN;
+			fwrite(y, sizeof(double), m, stdout);
+			continue;
+		}
+		rangeFill(&r, 0, x, m);
+		for (i = 0; i < m; i++)
+			if (e[i])
+				printf("%.17g\terror %d\n", x[i], e[i]);
+			else
+				printf("%.17g\t%.17g\n", x[i], y[i]);
+	}
 
-		/*----------------------------------------------------------
-			expr() actually starts the recursive decent parser
-		-----------------------------------------------------------*/
-		rval = expr();
+	if (err)
+		fprintf(stderr, "tabulation failed with code %d\n", err);
+	free(e);
+	free(y);
+	free(x);
+	disposProgram(p);
+	disposParseTree(tree);
+	fflush(stdout);
+	return (err ? 1 : 0);
+}
 
-		/*---------------------------------------------------------
-			This code checks for incomplete evaluation of the
-			expression.  The parser can be fooled into evaluating
-			the first part of an expression and then thinking that
-			it is done.  This can only happen with illegal
-			expressions.
-		---------------------------------------------------------*/
-		while (*Str != '\0')
+static int stream(int argc, char *argv[])
+{
+	char *cols = NULL, *range = NULL, *name, **file;
+	int i, nfile = 0, status = 0, nthread = 1, binary = 0;
+
+	if ((file = (char **)malloc(argc * sizeof(char *))) == NULL)
+		return (1);
+	for (i = 1; i < argc; i++)
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cols = argv[++i];
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			nthread = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			range = argv[++i];
+		else if (strcmp(argv[i], "-b") == 0)
+			binary = 1;
+		else
+			file[nfile++] = argv[i];
+	if (range != NULL)
+	{
+		status = tabulateMain(nfile ? file[0] : NULL, range, binary, nthread);
+		free(file);
+		return (status);
+	}
+#if PARALLEL
+	if (nthread <= 0)
+		nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthread > 64)
+		nthread = 64;
+#endif
+	if (nthread <= 0)
+		nthread = 1;
+
+	/*---------------------------------------------------
+		The variables are all defined before any thread
+		starts, as defineVariable() requires.
+	---------------------------------------------------*/
+	Stream.handle = (int *)malloc(((cols ? strlen(cols) : 0) + 1) * sizeof(int));
+	if (Stream.handle == NULL)
+	{
+		Stream.bad = 1;
+		goto done;
+	}
+	for (name = cols ? strtok(cols, ",") : NULL; name != NULL;
+		 name = strtok(NULL, ","))
+		if ((Stream.handle[Stream.ncol++] = defineVariable(name, 0.0)) < 0)
 		{
-			if (*Str != ' ' && *Str != '\n' && *Str != '\t')
-			{
-				error(" unexpected symbol ");
-				break;
-			}
-			Str++;
+			fprintf(stderr, "cannot use %s as a variable\n", name);
+			status = 2;
+			goto done;
 		}
 
-		*err = ParseError;
-
-		if (ParseError)
+	Stream.cache = newExprCache(64 << 20);
+	Stream.job = (STREAMJOB *)calloc(nthread, sizeof(STREAMJOB));
+	if (Stream.cache == NULL || Stream.job == NULL)
+	{
+		Stream.bad = 1;
+		goto done;
+	}
+	Stream.njob = nthread;
+	for (i = 0; i < nthread; i++)
+		if ((Stream.job[i].ctx = newEvalCtx()) == NULL)
 		{
-			strcpy(err_mess, err1Message);
-			strcat(err_mess, "\n  ");
-			strcat(err_mess, err2Message);
-			disposParseTree(rval);
-			rval = NULL;
+			Stream.bad = 1;
+			goto done;
 		}
-		else
+	setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+	for (i = 0; i < nfile; i++)
+		if (streamFile(file[i]))
 		{
-			err_mess[0] = '\0';
+			fprintf(stderr, "cannot read %s\n", file[i]);
+			status = 1;
 		}
+	if (nfile == 0)
+		streamFile("-");
 
-		/*------------------------------------------------------
-			This line of code incremented our pointer to the
-			end of the parsed string, it is not really a good
-			side effect, so it was removed. Jan 28, '89.
-		*expr_p = Str ;
-		--------------------------------------------------------*/
+done:
+	for (i = 0; i < Stream.njob; i++)
+	{
+		disposParseTree(Stream.job[i].tree);
+		disposEvalCtx(Stream.job[i].ctx);
+		free(Stream.job[i].last);
+		free(Stream.job[i].line);
+		free(Stream.job[i].out);
+	}
+	free(Stream.job);
+	free(Stream.handle);
+	free(file);
+	disposExprCache(Stream.cache);
+	fflush(stdout);
+	if (Stream.bad)
+	{
+		fprintf(stderr, "out of memory\n");
+		status = 1;
 	}
-	return ((void *)rval);
+	return (status);
 }
 
-/*************************** main()  *************************************\
-\*-----------------------------------------------------------------------*/
 
-#if MAIN
-
-int main(void)
+int main(int argc, char *argv[])
 
 {
 
 	int e_err = 0, p_err = 0;
 	char buf[255], *p, p_err_mess[80];
-	PARSETREE tree = NULL;
+	void *tree = NULL;
 	long double temp = 0.0;
 	char prompt[254] = "\nEnter an expression, or return to quit >";
 
+	if (argc > 1)
+		return (stream(argc, argv));
+
 	printf("%s", prompt);
 
 	// for ( ; gets( buf ); printf(">") ) {
@@ -1 +1 @@
-#pragma once/* parseTree.c */int setVariable(char *, long double);void *parse(char *[], int *, char[]);long double eval(void *, int *);void disposParseTree(void *);
\ No newline at end of file
+#pragma once#include <stddef.h>/* precisions for evalPrec() */#define PREC_DEFAULT 0#define PREC_FLOAT 1#define PREC_DOUBLE 2#define PREC_LONG 3/* parseTree.c */int setVariable(char *, long double);void *parse(char *[], int *, char[]);long double eval(void *, int *);void disposParseTree(void *);void *optimize(void *, int *);void *compile(void *, int *);long double evalCompiled(void *, int *);void disposProgram(void *);int evalBatch(void *, const double *, double *, size_t, int *);int evalBatchCompiled(void *, const double *, double *, size_t, int *);void *newEvalCtx(void);void disposEvalCtx(void *);int setVariableCtx(void *, char *, long double);long double evalCtx(void *, void *, int *);void *optimizeCtx(void *, void *, int *);long double evalCompiledCtx(void *, void *, int *);int evalBatchCtx(void *, void *, const double *, double *, size_t, int *);int evalBatchCompiledCtx(void *, void *, const double *, double *, size_t,						 int *);int evalParallel(void *, const double *, double *, size_t, int *, int);int evalParallelCtx(void *, void *, const double *, double *, size_t, int *,					int);long double evalPrec(void *, int, int *);long double evalPrecCtx(void *, void *, int, int *);int defineVariable(char *, long double);int getVarHandle(char *);int setVariableByHandle(int, long double);int setVariableByHandleCtx(void *, int, long double);void *newExprCache(size_t);void *cacheParse(void *, char *[], int *, char[]);void cacheStats(void *, long *, long *, size_t *);void disposExprCache(void *);size_t writeProgram(void *, void *, size_t);void *readProgram(const void *, size_t, size_t *, int *);void *mapPrograms(char *, size_t *);void unmapPrograms(void *, size_t);void *newIncremental(void *, int *);long double evalIncremental(void *, int *);long double evalIncrementalCtx(void *, void *, int *);void disposIncremental(void *);void *newMultiEval(void *[], int, int *);int evalMulti(void *, long double[], int[]);int evalMultiCtx(void *, void *, long double[], int[]);int evalMultiBatch(void *, const double *, double *, size_t, int *);int evalMultiBatchCtx(void *, void *, const double *, double *, size_t,					  int *);void disposMultiEval(void *);void *compileNative(void *, int *);double (*nativeFunction(void *))(const double *);long double evalNative(void *, int *);long double evalNativeCtx(void *, void *, int *);void disposNative(void *);size_t emitC(void *, char *, int, char *, size_t);int tabulate(void *, char *, double, double, size_t, double *);int tabulateCtx(void *, void *, char *, double, double, size_t, double *,				int *, int);int evalInterval(void *, char *, long double, long double, long double *,				 long double *);int evalIntervalCtx(void *, void *, char *, long double, long double,					long double *, long double *);void *differentiate(void *, char *, int *);
\ No newline at end of file